@@ -0,0 +1,356 @@
+-- See Copyright Notice in ../LICENSE.txt
+
+--allocators for temporary data, loaded with terralib.require("std.alloc")
+--
+--    alloc.Bump          a fixed buffer; allocation bumps a pointer, mark()/rewind(m) free everything allocated after a mark
+--    alloc.Arena         a growable list of chunks; allocation bumps a pointer in the newest chunk, reset() frees everything at once
+--    alloc.TypedArena(T) an Arena that hands out arrays of T
+--    alloc.Pool(T)       fixed-size objects of type T with a free list, safe to use from multiple threads.
+--                        each thread keeps a small cache of free objects, so most alloc()/release(p) calls do not take a lock
+--
+--Bump and Arena also have the macro method new(T,[N]), which allocates space for N (default 1) values of type T:
+--
+--    var a : alloc.Arena
+--    a:init(1024*1024)
+--    var xs = a:new(float,N)
+--    ...
+--    a:reset()
+
+local terracode = terra.loadstring [==[
+local C = terralib.includecstring [[
+#include <stdlib.h>
+#include <pthread.h>
+]]
+
+local alloc = {}
+
+local terra alignup(x : uint64, align : uint64) : uint64
+    return (x + align - 1) and not (align - 1)
+end
+
+--alignment used when allocating values of type T, at least what malloc guarantees
+local function alignmentof(T)
+    local a = 16
+    local elem = T
+    while elem:isarray() do
+        elem = elem.type
+    end
+    if elem:isvector() then
+        a = math.max(a,terralib.sizeof(elem))
+    elseif elem:isstruct() then
+        a = math.max(a,elem:getlayout().alignment or 0)
+    end
+    return a
+end
+
+local function addnew(S)
+    S.methods.new = macro(function(self,T,N)
+        T = T:astype()
+        N = N or 1
+        return `[&T](self:alloc(sizeof(T)*N,[alignmentof(T)]))
+    end)
+end
+
+struct alloc.Bump {
+    base : &uint8;
+    size : uint64;
+    used : uint64;
+}
+local Bump = alloc.Bump
+
+--if the buffer cannot be allocated it is empty, and every alloc returns nil
+terra Bump:init(size : uint64)
+    self.base = [&uint8](C.malloc(size))
+    self.size = size
+    if self.base == nil then
+        self.size = 0
+    end
+    self.used = 0
+end
+--returns nil when the buffer is full
+terra Bump:alloc(size : uint64, align : uint64) : &uint8
+    var start = alignup([uint64](self.base) + self.used,align) - [uint64](self.base)
+    if start + size > self.size then
+        return nil
+    end
+    self.used = start + size
+    return self.base + start
+end
+terra Bump:mark() : uint64
+    return self.used
+end
+terra Bump:rewind(m : uint64)
+    self.used = m
+end
+terra Bump:free()
+    C.free(self.base)
+    self.base = nil
+    self.size = 0
+    self.used = 0
+end
+addnew(Bump)
+
+struct Chunk {
+    next : &Chunk;
+    size : uint64;
+}
+
+struct alloc.Arena {
+    current : &Chunk; --newest chunk, its data follows the header
+    used : uint64;
+    chunksize : uint64;
+}
+local Arena = alloc.Arena
+
+terra Arena:init(chunksize : uint64)
+    self.current = nil
+    self.used = 0
+    self.chunksize = chunksize
+end
+--returns nil when a new chunk cannot be allocated
+terra Arena:alloc(size : uint64, align : uint64) : &uint8
+    if self.current ~= nil then
+        var data = [&uint8](self.current + 1)
+        var start = alignup([uint64](data) + self.used,align) - [uint64](data)
+        if start + size <= self.current.size then
+            self.used = start + size
+            return data + start
+        end
+    end
+    var csize = self.chunksize
+    if size + align > csize then
+        csize = size + align
+    end
+    var chunk = [&Chunk](C.malloc(sizeof(Chunk) + csize))
+    if chunk == nil then
+        return nil
+    end
+    chunk.next = self.current
+    chunk.size = csize
+    self.current = chunk
+    self.used = 0
+    return self:alloc(size,align)
+end
+local terra freechunks(c : &Chunk)
+    while c ~= nil do
+        var n = c.next
+        C.free(c)
+        c = n
+    end
+end
+--frees everything allocated from the arena, keeping the newest chunk for reuse
+terra Arena:reset()
+    if self.current ~= nil then
+        freechunks(self.current.next)
+        self.current.next = nil
+    end
+    self.used = 0
+end
+terra Arena:free()
+    freechunks(self.current)
+    self.current = nil
+    self.used = 0
+end
+addnew(Arena)
+
+local typedarenas = {}
+function alloc.TypedArena(T)
+    if typedarenas[T] then
+        return typedarenas[T]
+    end
+    local struct TypedArena {
+        arena : Arena;
+    }
+    TypedArena.displayname = "TypedArena("..tostring(T)..")"
+    --chunks hold chunkelements values of T
+    terra TypedArena:init(chunkelements : uint64)
+        self.arena:init(chunkelements*sizeof(T))
+    end
+    terra TypedArena:new(N : uint64) : &T
+        return [&T](self.arena:alloc(sizeof(T)*N,[alignmentof(T)]))
+    end
+    terra TypedArena:reset()
+        self.arena:reset()
+    end
+    terra TypedArena:free()
+        self.arena:free()
+    end
+    TypedArena.elementtype = T
+    typedarenas[T] = TypedArena
+    return TypedArena
+end
+
+struct PoolNode {
+    next : &PoolNode;
+}
+--free objects cached by one thread
+struct PoolCache {
+    head : &PoolNode;
+    count : int;
+    pool : &uint8;
+    nextcache : &PoolCache; --all caches of a pool, so they can be freed with it
+}
+
+--objects move between a thread's cache and the shared free list in batches of this size
+local BATCH = 32
+
+local pools = {}
+function alloc.Pool(T)
+    if pools[T] then
+        return pools[T]
+    end
+    local function roundup(x,a)
+        return math.ceil(x/a)*a
+    end
+    local objalign = alignmentof(T)
+    local objsize = roundup(math.max(terralib.sizeof(T),terralib.sizeof(&uint8)),objalign)
+    local slabheader = roundup(terralib.sizeof(&uint8),objalign)
+
+    local struct Pool {
+        lock : C.pthread_mutex_t;
+        key : C.pthread_key_t;
+        free : &PoolNode;
+        slabs : &uint8; --each slab starts with a pointer to the next one
+        caches : &PoolCache;
+        slabobjects : int;
+    }
+    Pool.displayname = "Pool("..tostring(T)..")"
+
+    --move up to count objects from a thread cache to the shared free list
+    terra Pool:flush(c : &PoolCache, count : int)
+        C.pthread_mutex_lock(&self.lock)
+        while count > 0 and c.head ~= nil do
+            var n = c.head
+            c.head = n.next
+            n.next = self.free
+            self.free = n
+            c.count = c.count - 1
+            count = count - 1
+        end
+        C.pthread_mutex_unlock(&self.lock)
+    end
+    --when a thread exits, its cached objects go back to the shared list
+    local terra releasecache(p : &uint8)
+        var c = [&PoolCache](p)
+        var pool = [&Pool](c.pool)
+        pool:flush(c,c.count)
+    end
+
+    terra Pool:init(slabobjects : int)
+        C.pthread_mutex_init(&self.lock,nil)
+        C.pthread_key_create(&self.key,releasecache)
+        self.free = nil
+        self.slabs = nil
+        self.caches = nil
+        self.slabobjects = slabobjects
+    end
+    terra Pool:getcache() : &PoolCache
+        var c = [&PoolCache](C.pthread_getspecific(self.key))
+        if c == nil then
+            c = [&PoolCache](C.malloc(sizeof(PoolCache)))
+            if c == nil then
+                return nil
+            end
+            c.head = nil
+            c.count = 0
+            c.pool = [&uint8](self)
+            C.pthread_mutex_lock(&self.lock)
+            c.nextcache = self.caches
+            self.caches = c
+            C.pthread_mutex_unlock(&self.lock)
+            C.pthread_setspecific(self.key,c)
+        end
+        return c
+    end
+    terra Pool:refill(c : &PoolCache)
+        C.pthread_mutex_lock(&self.lock)
+        if self.free == nil then
+            --objects are at fixed offsets from the start of the slab, so the slab itself has to be aligned
+            var slab : &uint8
+            if C.posix_memalign(&slab,objalign,slabheader + objsize*self.slabobjects) ~= 0 then
+                C.pthread_mutex_unlock(&self.lock)
+                return
+            end
+            @[&&uint8](slab) = self.slabs
+            self.slabs = slab
+            for i = 0,self.slabobjects do
+                var n = [&PoolNode](slab + slabheader + i*objsize)
+                n.next = self.free
+                self.free = n
+            end
+        end
+        var i = 0
+        while i < BATCH and self.free ~= nil do
+            var n = self.free
+            self.free = n.next
+            n.next = c.head
+            c.head = n
+            c.count = c.count + 1
+            i = i + 1
+        end
+        C.pthread_mutex_unlock(&self.lock)
+    end
+    --returns nil when the thread's cache or a new slab cannot be allocated
+    terra Pool:alloc() : &T
+        var c = self:getcache()
+        if c == nil then
+            return nil
+        end
+        if c.head == nil then
+            self:refill(c)
+            if c.head == nil then
+                return nil
+            end
+        end
+        var n = c.head
+        c.head = n.next
+        c.count = c.count - 1
+        return [&T](n)
+    end
+    terra Pool:release(p : &T)
+        var c = self:getcache()
+        var n = [&PoolNode](p)
+        if c == nil then --no cache for this thread, return the object straight to the shared list
+            C.pthread_mutex_lock(&self.lock)
+            n.next = self.free
+            self.free = n
+            C.pthread_mutex_unlock(&self.lock)
+            return
+        end
+        n.next = c.head
+        c.head = n
+        c.count = c.count + 1
+        if c.count > 2*BATCH then
+            self:flush(c,BATCH)
+        end
+    end
+    --frees every object allocated from the pool
+    terra Pool:free()
+        C.pthread_key_delete(self.key)
+        var s = self.slabs
+        while s ~= nil do
+            var n = @[&&uint8](s)
+            C.free(s)
+            s = n
+        end
+        var c = self.caches
+        while c ~= nil do
+            var n = c.nextcache
+            C.free(c)
+            c = n
+        end
+        self.slabs = nil
+        self.caches = nil
+        self.free = nil
+        C.pthread_mutex_destroy(&self.lock)
+    end
+
+    Pool.elementtype = T
+    pools[T] = Pool
+    return Pool
+end
+
+return alloc
+]==]
+
+return terracode()
@@ -0,0 +1,330 @@
+-- See Copyright Notice in ../LICENSE.txt
+
+--lazy array expressions, loaded with terralib.require("std.fusion")
+--arithmetic on arrays builds an expression DAG instead of computing anything. Evaluating the expressions
+--(or reducing them) generates a single vectorized loop for the whole DAG, so no temporaries are allocated:
+--
+--    local a,b = fusion.array(double,N), fusion.array(double,N)
+--    local c = fusion.eval(a*2 + b) --one loop, writes c
+--    local s = fusion.sum(a*b)      --one loop, no array for a*b
+--
+--generated kernels are cached by the shape of the expression (its operators, element type and which leaves are shared),
+--so reevaluating an expression with different arrays or constants reuses the compiled loop.
+
+local terracode = terra.loadstring [==[
+local fusion = {}
+
+local Node = {}
+Node.__index = Node
+
+local function isnode(v)
+    return getmetatable(v) == Node
+end
+fusion.isexpression = isnode
+
+local function checktype(T)
+    if not terralib.types.istype(T) or not T:isprimitive() or not (T:isfloat() or (T:isintegral() and T.bytes <= 4)) then
+        error("fusion arrays hold floats, doubles or integers of at most 32 bits but found "..tostring(T),3)
+    end
+end
+
+--a new zero-initialized array of N values of type T, the values are in a.data[0] ... a.data[N-1]
+function fusion.array(T,N)
+    checktype(T)
+    return setmetatable({ kind = "array", type = T, N = N, data = terralib.new(T[N]) },Node)
+end
+
+--an array that refers to N values of type T in existing memory at ptr, the memory must outlive the array
+function fusion.wrap(T,ptr,N)
+    checktype(T)
+    return setmetatable({ kind = "array", type = T, N = N, data = terralib.cast(&T,ptr) },Node)
+end
+
+local function tonode(v)
+    if isnode(v) then
+        return v
+    elseif type(v) == "number" then
+        return setmetatable({ kind = "constant", value = v },Node)
+    end
+    error("expected a fusion array, expression or number but found "..tostring(v),3)
+end
+
+local function operator(op,...)
+    local args = terralib.newlist({...}):map(tonode)
+    return setmetatable({ kind = "op", op = op, args = args },Node)
+end
+
+Node.__add = function(a,b) return operator("+",a,b) end
+Node.__sub = function(a,b) return operator("-",a,b) end
+Node.__mul = function(a,b) return operator("*",a,b) end
+Node.__div = function(a,b) return operator("/",a,b) end
+Node.__unm = function(a) return operator("neg",a) end
+
+function fusion.min(a,b)
+    return operator("min",a,b)
+end
+function fusion.max(a,b)
+    return operator("max",a,b)
+end
+
+--lifts fn, a terra function (or C function) over scalars of the element type, into a function on expressions
+local mapids = setmetatable({},{ __mode = "k" })
+local nextmapid = 0
+function fusion.map(fn)
+    if not mapids[fn] then
+        nextmapid = nextmapid + 1
+        mapids[fn] = nextmapid
+    end
+    return function(...)
+        local n = operator("map",...)
+        n.fn = fn
+        return n
+    end
+end
+
+--flattens the DAG reachable from roots into a list of nodes in dependency order
+--and builds a key that is equal for two DAGs exactly when they can share a kernel
+local function linearize(roots,mode)
+    local shape = { nodes = terralib.newlist(), arrays = terralib.newlist(), constants = terralib.newlist(), roots = terralib.newlist() }
+    local ids = {}
+    local key = terralib.newlist()
+    local function visit(n)
+        if ids[n] then
+            return ids[n]
+        end
+        local desc
+        local entry = { kind = n.kind }
+        if n.kind == "array" then
+            shape.type = shape.type or n.type
+            shape.N = shape.N or n.N
+            if n.type ~= shape.type or n.N ~= shape.N then
+                error(("arrays in an expression must have the same type and size but found %s[%d] and %s[%d]"):format(tostring(shape.type),shape.N,tostring(n.type),n.N),4)
+            end
+            shape.arrays:insert(n)
+            entry.index = #shape.arrays
+            desc = "a"
+        elseif n.kind == "constant" then
+            shape.constants:insert(n.value)
+            entry.index = #shape.constants
+            desc = "c"
+        else
+            entry.op, entry.fn = n.op, n.fn
+            entry.args = n.args:map(visit)
+            desc = (n.fn and "map"..mapids[n.fn] or n.op).."("..entry.args:mkstring(",")..")"
+        end
+        shape.nodes:insert(entry)
+        ids[n] = #shape.nodes
+        key:insert(desc)
+        return ids[n]
+    end
+    for i,r in ipairs(roots) do
+        shape.roots:insert(visit(tonode(r)))
+    end
+    if not shape.type then
+        error("expression does not contain any arrays",3)
+    end
+    shape.key = tostring(shape.type).."|"..mode.."|"..key:mkstring(";").."|"..shape.roots:mkstring(",")
+    return shape
+end
+
+--code for the elementwise operators, also used to combine partial results of reductions
+local binaryops = {
+    ["+"] = function(a,b) return `a + b end;
+    ["-"] = function(a,b) return `a - b end;
+    ["*"] = function(a,b) return `a * b end;
+    ["/"] = function(a,b) return `a / b end;
+    min = function(a,b) return `terralib.select(a < b,a,b) end;
+    max = function(a,b) return `terralib.select(a > b,a,b) end;
+}
+local reductionops = { sum = "+", product = "*", min = "min", max = "max" }
+local function combine(reduction,a,b)
+    return binaryops[reductionops[reduction]](a,b)
+end
+
+local function identity(reduction,T)
+    if reduction == "sum" then
+        return 0
+    elseif reduction == "product" then
+        return 1
+    end
+    local sign = (reduction == "min" and 1) or -1
+    if T:isfloat() then
+        return sign*math.huge
+    end
+    local bits = T.bytes*8
+    if T.signed then
+        return (sign > 0 and 2^(bits-1) - 1) or -2^(bits-1)
+    else
+        return (sign > 0 and 2^bits - 1) or 0
+    end
+end
+
+--number of elements processed per iteration of the vectorized loop
+function fusion.vectorwidth(T)
+    return math.max(1,math.floor(terralib.nativevectorbytes / T.bytes))
+end
+
+local function compilekernel(shape,reduction)
+    local T = shape.type
+    local VL = fusion.vectorwidth(T)
+    local N = symbol(int64,"N")
+    local arraysyms = shape.arrays:map(function() return symbol(&T) end)
+    local constsyms = shape.constants:map(function() return symbol(T) end)
+    local outsyms = (reduction and terralib.newlist()) or shape.roots:map(function() return symbol(&T) end)
+
+    --statements computing every node for W elements starting at index i
+    local function body(W,i)
+        local VT = (W > 1 and vector(T,W)) or T
+        local stmts = terralib.newlist()
+        local vals = terralib.newlist()
+        for k,n in ipairs(shape.nodes) do
+            local rhs
+            if n.kind == "array" then
+                local p = arraysyms[n.index]
+                rhs = (W > 1 and `terralib.aligned(@[&VT](p + i),[T.bytes])) or `p[i]
+            elseif n.kind == "constant" then
+                rhs = `[VT]([constsyms[n.index]])
+            else
+                local a = n.args:map(function(id) return vals[id] end)
+                if n.op == "neg" then
+                    rhs = `-[a[1]]
+                elseif n.op == "map" then
+                    local fn = n.fn
+                    if W == 1 then
+                        rhs = `[VT](fn([a]))
+                    else
+                        local lanes = terralib.newlist()
+                        for l = 0,W-1 do
+                            lanes:insert(`[T](fn([a:map(function(x) return `x[l] end)])))
+                        end
+                        rhs = `vector([lanes])
+                    end
+                else
+                    rhs = binaryops[n.op](a[1],a[2])
+                end
+            end
+            local v = symbol(VT)
+            stmts:insert(quote var [v] = [rhs] end)
+            vals:insert(v)
+        end
+        return stmts,vals
+    end
+
+    local iv,is = symbol(int64),symbol(int64)
+    local vstmts,vvals = body(VL,iv)
+    local sstmts,svals = body(1,is)
+    local vend = symbol(int64)
+    local kernel
+    if reduction then
+        local root = shape.roots[1]
+        local acc,r = symbol(vector(T,VL)),symbol(T)
+        local init = identity(reduction,T)
+        local lanes = terralib.newlist()
+        for l = 0,VL-1 do
+            lanes:insert(quote [r] = [combine(reduction,r,`acc[l])] end)
+        end
+        kernel = terra([N],[arraysyms],[constsyms]) : T
+            var [vend] = N - N % VL
+            var [acc] = [vector(T,VL)](init)
+            for [iv] = 0,vend,VL do
+                [vstmts]
+                acc = [combine(reduction,acc,vvals[root])]
+            end
+            var [r] = [T](init)
+            [lanes]
+            for [is] = vend,N do
+                [sstmts]
+                r = [combine(reduction,r,svals[root])]
+            end
+            return r
+        end
+    else
+        local vstores,sstores = terralib.newlist(),terralib.newlist()
+        for k,root in ipairs(shape.roots) do
+            local out = outsyms[k]
+            vstores:insert(quote terralib.aligned(@[&vector(T,VL)](out + iv),[T.bytes]) = [vvals[root]] end)
+            sstores:insert(quote out[is] = [svals[root]] end)
+        end
+        kernel = terra([N],[arraysyms],[constsyms],[outsyms])
+            var [vend] = N - N % VL
+            for [iv] = 0,vend,VL do
+                [vstmts]
+                [vstores]
+            end
+            for [is] = vend,N do
+                [sstmts]
+                [sstores]
+            end
+        end
+    end
+    kernel:compile()
+    return kernel
+end
+
+local kernels = {}
+local stats = { compiled = 0, reused = 0 }
+
+local function execute(roots,reduction,outputs)
+    local shape = linearize(roots,reduction or "eval")
+    local kernel = kernels[shape.key]
+    if kernel then
+        stats.reused = stats.reused + 1
+    else
+        kernel = compilekernel(shape,reduction)
+        kernels[shape.key] = kernel
+        stats.compiled = stats.compiled + 1
+    end
+    local args = terralib.newlist { shape.N }
+    for i,a in ipairs(shape.arrays) do
+        args:insert(a.data)
+    end
+    for i,c in ipairs(shape.constants) do
+        args:insert(c)
+    end
+    if reduction then
+        return kernel(unpack(args))
+    end
+    for i = 1,#roots do
+        local o = outputs[i]
+        if not o then
+            o = fusion.array(shape.type,shape.N)
+            outputs[i] = o
+        elseif not isnode(o) or o.kind ~= "array" or o.type ~= shape.type or o.N ~= shape.N then
+            error(("expected a destination array of type %s[%d]"):format(tostring(shape.type),shape.N),3)
+        end
+        args:insert(o.data)
+    end
+    kernel(unpack(args))
+    return unpack(outputs)
+end
+
+--evaluates one or more expressions in a single loop, returning a new array for each
+function fusion.eval(...)
+    return execute({...},nil,{})
+end
+--evaluates the expression exp and stores the result into the existing array dest (which may also appear in exp)
+function fusion.assign(dest,exp)
+    return execute({exp},nil,{dest})
+end
+function Node:eval()
+    return fusion.eval(self)
+end
+
+--reductions, the elementwise part of the expression is computed in the same loop
+--floating point sums and products are accumulated per vector lane, so rounding can differ from a sequential loop
+for reduction in pairs(reductionops) do
+    local name = (reduction == "min" and "minimum") or (reduction == "max" and "maximum") or reduction
+    fusion[name] = function(exp)
+        return execute({exp},reduction)
+    end
+end
+
+--returns how many kernels were compiled and how many evaluations reused a cached kernel
+function fusion.stats()
+    return stats.compiled,stats.reused
+end
+
+return fusion
+]==]
+
+return terracode()
@@ -44,6 +44,7 @@
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/ExecutionEngine/JITEventListener.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Dwarf.h"
 
 #if LLVM_3_2
 
@@ -51,6 +52,8 @@
 #include "llvm/DataLayout.h"
 #include "clang/Rewrite/Core/Rewriter.h"
 #include "clang/Rewrite/Frontend/Rewriters.h"
+#include "llvm/DebugInfo.h"
+#include "llvm/DIBuilder.h"
 
 #define HASFNATTR(attr) getFnAttributes().hasAttribute(Attributes :: attr)
 #define ADDFNATTR(attr) addFnAttr(Attributes :: attr)
@@ -64,6 +67,8 @@
 #include "llvm/Target/TargetData.h"
 #include "clang/Rewrite/Rewriter.h"
 #include "clang/Rewrite/Rewriters.h"
+#include "llvm/Analysis/DebugInfo.h"
+#include "llvm/Analysis/DIBuilder.h"
 
 #define HASFNATTR(attr) hasFnAttr(Attribute :: attr)
 #define ADDFNATTR(attr) addFnAttr(Attribute :: attr)
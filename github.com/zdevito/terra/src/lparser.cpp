@@ -1941,11 +1941,17 @@ static void exprstat (LexState *ls) {
 
 
 static void retstat (LexState *ls) {
-  /* stat -> RETURN [explist] [';'] */
+  /* stat -> RETURN [tailcall] [explist] [';'] */
   FuncState *fs = ls->fs;
   expdesc e;
   int tbl = new_table(ls,T_return);
   int first, nret;  /* registers with returned values */
+  int tailcall = 0;
+  /* 'tailcall' is only a keyword in terra code, and only when followed by the function being called */
+  if (ls->in_terra && ls->t.token == TK_NAME && strcmp(getstr(ls->t.seminfo.ts),"tailcall") == 0 && luaX_lookahead(ls) == TK_NAME) {
+    luaX_next(ls);
+    tailcall = 1;
+  }
   if (block_follow(ls, 1) || ls->t.token == ';') {
     first = nret = 0;  /* return no values */
     new_list(ls);
@@ -1953,6 +1959,8 @@ static void retstat (LexState *ls) {
     RETURNS_1(nret = explist(ls, &e));  /* optional return values */
   }
   add_field(ls,tbl,"expressions");
+  push_boolean(ls,tailcall);
+  add_field(ls,tbl,"tailcall");
   testnext(ls, ';');  /* skip optional semicolon */
 }
 
@@ -24,7 +24,7 @@ static void doerror(lua_State * L) {
 }
 const char * progname = NULL;
 static void dotty (lua_State *L);
-void parse_args(lua_State * L, int argc, char ** argv, bool * interactive, int * begin_script);
+void parse_args(lua_State * L, int argc, char ** argv, bool * interactive, bool * executed, int * begin_script);
 static int getargs (lua_State *L, char **argv, int n);
 
 int main(int argc, char ** argv) {
@@ -34,9 +34,10 @@ int main(int argc, char ** argv) {
     if(terra_init(L))
         doerror(L);
     bool interactive = false;
+    bool executed = false;
     int scriptidx;
 
-    parse_args(L,argc,argv,&interactive,&scriptidx);
+    parse_args(L,argc,argv,&interactive,&executed,&scriptidx);
     
     if(scriptidx < argc) {
       int narg = getargs(L, argv, scriptidx);  
@@ -48,7 +49,7 @@ int main(int argc, char ** argv) {
         doerror(L);
     }
     
-    if(isatty(0) && (interactive || scriptidx == argc)) {
+    if(isatty(0) && (interactive || (scriptidx == argc && !executed))) {
         progname = NULL;
         dotty(L);
     }
@@ -63,16 +64,20 @@ void usage() {
     print_welcome();
     printf("terra [OPTIONS] [source-file] [arguments-to-source-file]\n"
            "    -v enable verbose debugging output\n"
+           "    -g generate debug information (line tables and variable locations) for terra functions\n"
+           "    -e <code> run the terra code <code> (can be repeated)\n"
            "    -h print this help message\n"
            "    -i enter the REPL after processing source files\n"
            "    -l <language_file> specify a module that defines a language extension (can be repeated)\n");
 }
 
-void parse_args(lua_State * L, int  argc, char ** argv, bool * interactive, int * begin_script) {
+void parse_args(lua_State * L, int  argc, char ** argv, bool * interactive, bool * executed, int * begin_script) {
     int ch;
     static struct option longopts[] = {
         { "help",      0,     NULL,           'h' },
         { "verbose",   0,     NULL,           'v' },
+        { "debug",     0,     NULL,           'g' },
+        { "execute",   1,     NULL,           'e' },
         { "interactive",     0,     NULL,     'i' },
         { "language", 1, NULL,                'l' },
         { NULL,        0,     NULL,            0 }
@@ -80,12 +85,23 @@ void parse_args(lua_State * L, int  argc, char ** argv, bool * interactive, int
     int verbose = 0;
     /*  Parse commandline options  */
     opterr = 0;
-    while ((ch = getopt_long(argc, argv, "+hvil:", longopts, NULL)) != -1) {
+    while ((ch = getopt_long(argc, argv, "+hvge:il:", longopts, NULL)) != -1) {
         switch (ch) {
             case 'v':
                 verbose++;
                 terra_setverbose(L,verbose);
                 break;
+            case 'g':
+                lua_getfield(L, LUA_GLOBALSINDEX, "terra");
+                lua_pushboolean(L, 1);
+                lua_setfield(L, -2, "debuginfo");
+                lua_pop(L, 1);
+                break;
+            case 'e':
+                if(terra_dostring(L,optarg))
+                    doerror(L);
+                *executed = true;
+                break;
             case 'i':
                 *interactive = true;
                 break;
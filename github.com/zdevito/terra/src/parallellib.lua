@@ -0,0 +1,65 @@
+-- See Copyright Notice in ../LICENSE.txt
+
+--parallel loops, loaded with terralib.require("std.parallel")
+--parfor(begin,end,body,env,[grain]) runs body(i,env) for every i in [begin,end) using the
+--work-stealing thread pool in libterra. body is a terra function of type {int64,&T} -> {} and env is a &T
+--holding whatever the loop needs. Ranges are split until they have at most grain iterations
+--(by default a size is chosen from the number of threads):
+--
+--    struct Args { input : &float, output : &float }
+--    terra blur(i : int64, a : &Args)
+--        a.output[i] = (a.input[i-1] + a.input[i] + a.input[i+1])/3
+--    end
+--    var args = Args { input, output }
+--    parallel.parfor(1,N-1,blur,&args)
+--
+--the number of threads defaults to the number of cores and can be set with the TERRA_NUM_THREADS environment variable
+
+local terracode = terra.loadstring [==[
+local parallel = {}
+
+local runtime = terralib.constant({int64,int64,int64,{&uint8,int64,int64} -> {},&uint8} -> {}, terralib.parallelforimpl)
+
+--each body gets a wrapper that runs a whole range of iterations, so the runtime only makes one indirect call per range
+local chunks = {}
+local function chunkfor(body)
+    if chunks[body] then
+        return chunks[body]
+    end
+    if not terralib.isfunction(body) or #body:getdefinitions() ~= 1 then
+        error("parfor expects a terra function that is not overloaded as the loop body but found "..tostring(body))
+    end
+    local definition = body:getdefinitions()[1]
+    local success,typ = definition:peektype()
+    if not success then
+        typ = definition:gettype()
+    end
+    local params = typ.parameters
+    if #params ~= 2 or not params[1]:isintegral() or not params[2]:ispointer() then
+        error("parfor body must have type {int64,&T} -> {} but found "..tostring(typ))
+    end
+    local envtype = params[2]
+    local terra chunk(env : &uint8, b : int64, e : int64)
+        var penv = [envtype](env)
+        for i = b,e do
+            body(i,penv)
+        end
+    end
+    chunks[body] = chunk
+    return chunk
+end
+
+parallel.parfor = macro(function(b,e,body,env,grain)
+    local chunk = chunkfor(body:asvalue())
+    grain = grain or 0
+    return quote runtime(b,e,grain,chunk,env) end
+end)
+
+function parallel.numthreads()
+    return terralib.parallelnumthreads()
+end
+
+return parallel
+]==]
+
+return terracode()
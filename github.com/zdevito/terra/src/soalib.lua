@@ -0,0 +1,107 @@
+-- See Copyright Notice in ../LICENSE.txt
+
+--struct-of-arrays containers, loaded with terralib.require("std.soa")
+--SoA(T) creates a container type that stores each field of the struct T in its own array,
+--so a loop that touches one field reads contiguous memory and can be vectorized:
+--
+--    struct Particle { x : float, y : float, mass : float }
+--    local Particles = soa.SoA(Particle)
+--    var ps : Particles
+--    ps:init(N)
+--    for i = 0,N do
+--        ps.x[i] = ps.x[i] + ps.mass[i] --each field is a pointer to its own array
+--    end
+--    var p = ps:at(i) --element proxy, fields of the proxy are lvalues in the container
+--    p.y = p.x
+--    var v : Particle = ps:get(i)
+--    ps:set(i,v)
+--    ps:free()
+
+--since this file is loaded as Lua, we use terra.loadstring to inject the terra code
+local terracode = terra.loadstring [==[
+local C = terralib.includec("stdlib.h")
+
+local soa = {}
+local containers = {}
+
+function soa.SoA(T)
+    if containers[T] then
+        return containers[T]
+    end
+    if not terralib.types.istype(T) or not T:isstruct() then
+        error("SoA expects a struct type but found "..tostring(T),2)
+    end
+    local fields = terralib.newlist()
+    for i,e in ipairs(T:getlayout().entries) do
+        if e.inunion then
+            error("SoA does not support structs that contain unions: "..tostring(T),2)
+        end
+        fields:insert(e)
+    end
+
+    --the container has one field per field of T, so bookkeeping is stored under symbols that cannot conflict with them
+    local size = symbol("size")
+    local container = terralib.types.newstruct("SoA("..tostring(T)..")")
+    container.entries:insert { field = size, type = int64 }
+    for i,e in ipairs(fields) do
+        container.entries:insert { field = e.key, type = &e.type }
+    end
+
+    local data,idx = symbol("data"),symbol("idx")
+    local proxy = terralib.types.newstruct("SoAProxy("..tostring(T)..")")
+    proxy.entries:insert { field = data, type = &container }
+    proxy.entries:insert { field = idx, type = int64 }
+    proxy.metamethods.__get = {}
+    for i,e in ipairs(fields) do
+        proxy.metamethods.__get[e.key] = macro(function(self)
+            return `self.[data].[e.key][self.[idx]]
+        end)
+    end
+
+    local function eachfield(fn)
+        return fields:map(function(e) return fn(e.key,e.type) end)
+    end
+
+    terra container:init(N : int64)
+        self.[size] = N
+        [ eachfield(function(k,t) return quote self.[k] = [&t](C.malloc(sizeof(t)*N)) end end) ]
+    end
+    terra container:free()
+        [ eachfield(function(k,t) return quote C.free(self.[k]) end end) ]
+        self.[size] = 0
+    end
+    terra container:size()
+        return self.[size]
+    end
+    terra container:get(i : int64) : T
+        var r : T
+        [ eachfield(function(k,t) return quote r.[k] = self.[k][i] end end) ]
+        return r
+    end
+    terra container:set(i : int64, v : T)
+        [ eachfield(function(k,t) return quote self.[k][i] = v.[k] end end) ]
+    end
+    terra container:at(i : int64) : proxy
+        var p : proxy
+        p.[data] = self
+        p.[idx] = i
+        return p
+    end
+
+    terra proxy:load() : T
+        return self.[data]:get(self.[idx])
+    end
+    terra proxy:store(v : T)
+        self.[data]:set(self.[idx],v)
+    end
+
+    container.elementtype = T
+    container.proxytype = proxy
+    containers[T] = container
+    return container
+end
+
+return soa
+]==]
+
+return terracode()
@@ -13,15 +13,24 @@ extern "C" {
 #include <unistd.h>
 #include <cmath>
 #include <sstream>
+#include <algorithm>
 #include "llvmheaders.h"
 #include "tllvmutil.h"
 #include "tcompilerstate.h" //definition of terra_CompilerState which contains LLVM state
 #include "tobj.h"
 #include "tinline.h"
+#include "tperfmap.h"
+#include "tprofiler.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Threading.h"
 #include <sys/time.h>
+#include <pthread.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
 #include "llvm/ExecutionEngine/MCJIT.h"
 #include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Analysis/ConstantFolding.h"
 
 using namespace llvm;
 
@@ -39,7 +48,10 @@ using namespace llvm;
     _(linklibraryimpl,1) \
     _(currenttimeinseconds,0) \
     _(isintegral,0) \
-    _(dumpmodule,1)
+    _(dumpmodule,1) \
+    _(createluastub,1) /*generate a lua_CFunction that calls a compiled function directly, bypassing the ffi*/\
+    _(jitmemory,1) \
+    _(setjitmemorylimit,1)
 
 
 #define DEF_LIBFUNCTION(nm,isclo) static int terra_##nm(lua_State * L);
@@ -50,12 +62,50 @@ TERRALIB_FUNCTIONS(DEF_LIBFUNCTION)
 static llvm_shutdown_obj llvmshutdownobj;
 #endif
 
+//cpu features we generate code for, taken from the host so that JITed code only uses instructions it has
+//also determines the vector width reported to lua as terralib.nativevectorbytes
+static const char * HostTargetFeatures() {
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return "";
+    //avx needs both the cpu (bit 28) and the OS, which must save the ymm registers (osxsave, bit 27, and xcr0)
+    if((ecx & (1 << 28)) && (ecx & (1 << 27))) {
+        unsigned int xcr0, xcr0high;
+        __asm__ ("xgetbv" : "=a"(xcr0), "=d"(xcr0high) : "c"(0));
+        if((xcr0 & 6) == 6)
+            return "+avx";
+    }
+    if(ecx & (1 << 20))
+        return "+sse42";
+    if(ecx & (1 << 19))
+        return "+sse41";
+#endif
+    return "";
+}
+static const char * TERRA_TARGET_FEATURES = HostTargetFeatures();
+
 struct DisassembleFunctionListener : public JITEventListener {
     terra_State * T;
     DisassembleFunctionListener(terra_State * T_)
     : T(T_) {}
-    virtual void NotifyFunctionEmitted (const Function & f, void * data, size_t sz, const EmittedFunctionDetails &) {
+    virtual void NotifyFunctionEmitted (const Function & f, void * data, size_t sz, const EmittedFunctionDetails & details) {
         T->C->functionsizes[&f] = sz;
+        //report the function to external profilers, along with its line table when it has debug locations
+        std::vector<std::string> filenames;
+        std::vector<terra_LineEntry> lines;
+        filenames.reserve(details.LineStarts.size());
+        for(size_t i = 0; i < details.LineStarts.size(); i++) {
+            const DebugLoc & loc = details.LineStarts[i].Loc;
+            DIScope scope(loc.getScope(f.getContext()));
+            filenames.push_back(scope.getFilename().str());
+        }
+        for(size_t i = 0; i < details.LineStarts.size(); i++) {
+            terra_LineEntry e = { details.LineStarts[i].Address, (int) details.LineStarts[i].Loc.getLine(), filenames[i].c_str() };
+            lines.push_back(e);
+        }
+        terra_perfmapfunction(f.getName().str().c_str(), data, sz, lines);
+        terra_profileraddfunction(&f, f.getName().str().c_str(), data, sz);
     }
 };
 
@@ -111,6 +161,62 @@ static void RegisterFunction(struct terra_State * T, const char * name, int iscl
     lua_setfield(T->L,-2,name);
 }
 
+//command line options, the target registry, and LLVM's own locks are process-wide,
+//so they are set up once no matter how many terra_States are created or on which threads
+static pthread_once_t llvminitonce = PTHREAD_ONCE_INIT;
+static void InitializeLLVM() {
+    llvm_start_multithreaded();
+#ifdef PRINT_LLVM_TIMING_STATS
+    AddLLVMOptions(1,"-time-passes");
+#endif
+    AddLLVMOptions(1,"-x86-asm-syntax=intel");
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+}
+
+//deletes the LLVM objects created by terra_compilerstateinit, including the LLVMContext.
+//each object is stored in C as soon as it is created, so this also cleans up after an initialization that failed part way
+static void FreeLLVMState(terra_CompilerState * C) {
+    if(C->ee && C->jiteventlistener)
+        C->ee->UnregisterJITEventListener(C->jiteventlistener);
+    delete C->jiteventlistener;
+    delete C->mi;
+    delete C->fpm;
+    delete C->dibuilder;
+    if(C->ee) {
+        delete C->ee; //also deletes the module and jitmemory
+    } else {
+        delete C->jitmemory;
+        delete C->m;
+    }
+    delete C->tm; //owns td
+    delete C->ctx;
+    C->jiteventlistener = NULL;
+    C->mi = NULL;
+    C->fpm = NULL;
+    C->dibuilder = NULL;
+    C->ee = NULL;
+    C->jitmemory = NULL;
+    C->m = NULL;
+    C->tm = NULL;
+    C->td = NULL;
+    C->ctx = NULL;
+    C->initialized = false;
+}
+
+//called when the lua state is closed.
+//the gc handle is created before any function handle, so the code of all functions has already been deleted
+static int terra_compilerstatefree(lua_State * L) {
+    terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
+    terra_CompilerState * C = T->C;
+    FreeLLVMState(C);
+    free(C->dibuilderdirectory);
+    free(C);
+    T->C = NULL;
+    return 0;
+}
+
 int terra_compilerinit(struct terra_State * T) {
     lua_getfield(T->L,LUA_GLOBALSINDEX,"terra");
     
@@ -126,36 +232,74 @@ int terra_compilerinit(struct terra_State * T) {
 
     lua_setfield(T->L,-2, "llvmversion");
     
+    lua_pushnumber(T->L, strstr(TERRA_TARGET_FEATURES,"+avx") ? 32 : 16);
+    lua_setfield(T->L,-2, "nativevectorbytes");
+    
     lua_pop(T->L,1); //remove terra from stack
     
     T->C = (terra_CompilerState*) malloc(sizeof(terra_CompilerState));
     memset(T->C, 0, sizeof(terra_CompilerState));
+    T->C->luathread = pthread_self();
     
-#ifdef PRINT_LLVM_TIMING_STATS
-    AddLLVMOptions(1,"-time-passes");
-#endif
+    lua_getfield(T->L,LUA_GLOBALSINDEX,"terra");
+    lua_newuserdata(T->L,0);
+    lua_newtable(T->L);
+    lua_pushlightuserdata(T->L,(void*)T);
+    lua_pushcclosure(T->L,terra_compilerstatefree,1);
+    lua_setfield(T->L,-2,"__gc");
+    lua_setmetatable(T->L,-2);
+    lua_setfield(T->L,-2,"llvm_compilerstategchandle");
+    lua_pop(T->L,1); //remove terra from stack
+    
+    //the LLVM state itself is created by terra_compilerstateinit the first time something is compiled,
+    //so scripts that only run lua code do not pay for it at startup
+    return 0;
+}
 
-    AddLLVMOptions(1,"-x86-asm-syntax=intel");
-    InitializeNativeTarget();
-    InitializeNativeTargetAsmPrinter();
-    InitializeNativeTargetAsmParser();
+void terra_compilerstateinit(struct terra_State * T) {
+    if(T->C->initialized)
+        return;
+    pthread_once(&llvminitonce, InitializeLLVM);
+    
+    std::string Triple = llvm::sys::getDefaultTargetTriple();
+    std::string err;
+    const Target *TheTarget = TargetRegistry::lookupTarget(Triple, err);
+    if(!TheTarget) {
+        terra_reporterror(T,"llvm: %s\n",err.c_str());
+    }
     
-    T->C->ctx = &getGlobalContext();
+    //each terra_State has its own context, so states on different threads can compile at the same time
+    T->C->ctx = new LLVMContext();
     T->C->m = new Module("terra",*T->C->ctx);
     
     TargetOptions options;
+    //keep frame pointers in JITed code so the sampling profiler can walk through terra functions
+    options.NoFramePointerElim = true;
+    //with GuaranteedTailCallOpt, calls marked 'tail' between fastcc functions are always turned into jumps, which is what makes
+    //'return tailcall' safe for unbounded recursion. It also changes the fastcc convention of every function (the callee pops an
+    //aligned argument area, so callers and callees must agree on it) and turns off sibling calls to other functions,
+    //so it is only used when terra.usetailcalls is set before the state is initialized
+    lua_getfield(T->L,LUA_GLOBALSINDEX,"terra");
+    lua_getfield(T->L,-1,"usetailcalls");
+    T->C->guaranteedtailcalls = lua_toboolean(T->L,-1);
+    lua_pop(T->L,2);
+    options.GuaranteedTailCallOpt = T->C->guaranteedtailcalls;
     CodeGenOpt::Level OL = CodeGenOpt::Aggressive;
-    std::string Triple = llvm::sys::getDefaultTargetTriple();
-    std::string err;
-    const Target *TheTarget = TargetRegistry::lookupTarget(Triple, err);
-    TargetMachine * TM = TheTarget->createTargetMachine(Triple, "", "+avx", options,Reloc::Default,CodeModel::Default,OL);
+    TargetMachine * TM = TheTarget->createTargetMachine(Triple, "", TERRA_TARGET_FEATURES, options,Reloc::Default,CodeModel::Default,OL);
+    if(!TM) {
+        FreeLLVMState(T->C);
+        terra_reporterror(T,"llvm: unable to create a target machine for %s\n",Triple.c_str());
+    }
+    T->C->tm = TM;
     T->C->td = TM->TARGETDATA(get)();
     
     
-    T->C->ee = EngineBuilder(T->C->m).setErrorStr(&err).setEngineKind(EngineKind::JIT).setAllocateGVsWithCode(false).create();
+    T->C->jitmemory = new TerraJITMemoryManager();
+    T->C->ee = EngineBuilder(T->C->m).setErrorStr(&err).setEngineKind(EngineKind::JIT).setAllocateGVsWithCode(false).setTargetOptions(options).setJITMemoryManager(T->C->jitmemory).create();
     if (!T->C->ee) {
-        terra_pusherror(T,"llvm: %s\n",err.c_str());
-        return LUA_ERRRUN;
+        //terra_reporterror does not return, so the objects created so far are deleted first
+        FreeLLVMState(T->C);
+        terra_reporterror(T,"llvm: %s\n",err.c_str());
     }
     
     T->C->fpm = new FunctionPassManager(T->C->m);
@@ -164,21 +308,12 @@ int terra_compilerinit(struct terra_State * T) {
     OptInfo info; //TODO: make configurable from terra
     llvmutil_addoptimizationpasses(T->C->fpm,&info);
     
-    
-    
-    if(!TheTarget) {
-        terra_pusherror(T,"llvm: %s\n",err.c_str());
-        return LUA_ERRRUN;
-    }
-    
-    
-    T->C->tm = TM;
     T->C->mi = createManualFunctionInliningPass(T->C->td);
     T->C->mi->doInitialization();
+    terra_perfmapinit();
     T->C->jiteventlistener = new DisassembleFunctionListener(T);
     T->C->ee->RegisterJITEventListener(T->C->jiteventlistener);
-    
-    return 0;
+    T->C->initialized = true;
 }
 
 struct TType { //contains llvm raw type pointer and any metadata about it we need
@@ -246,16 +381,58 @@ struct CCallingConv {
         this->B = B;
     }
     
+    //alignment requested by terra code for values of this type (from aligned struct fields or struct.alignment)
+    //0 if the type just uses LLVM's alignment
+    unsigned GetRequestedAlignment(Obj * typ) {
+        switch(typ->kind("kind")) {
+            case T_struct: {
+                Obj layout;
+                if(typ->obj("cachedlayout",&layout))
+                    return layout.number("alignment");
+                return 0;
+            } break;
+            case T_array: {
+                Obj base;
+                typ->obj("type",&base);
+                return GetRequestedAlignment(&base);
+            } break;
+            default:
+                return 0;
+        }
+    }
+    static size_t RoundUp(size_t offset, size_t align) {
+        return (offset + align - 1) / align * align;
+    }
+    //add a field to a struct that is being laid out, offset is the size of the struct so far.
+    //if the field requests more alignment than LLVM would give it, explicit padding is inserted before it
+    //(this assumes the struct itself is placed at its requested alignment, which allocas and globals ensure)
+    //returns the index of the field in the LLVM struct
+    int AddStructField(std::vector<Type *> * entry_types, size_t * offset, unsigned * maxalign, Type * t, unsigned requested) {
+        unsigned abialign = C->td->getABITypeAlignment(t);
+        size_t natural = RoundUp(*offset,abialign);
+        size_t aligned = (requested > abialign) ? RoundUp(natural,requested) : natural;
+        if(aligned > natural)
+            entry_types->push_back(ArrayType::get(Type::getInt8Ty(*C->ctx),aligned - *offset));
+        entry_types->push_back(t);
+        *offset = aligned + C->td->getTypeAllocSize(t);
+        if(abialign > *maxalign)
+            *maxalign = abialign;
+        return entry_types->size() - 1;
+    }
     void LayoutStruct(StructType * st, Obj * typ) {
         Obj layout;
         GetStructEntries(typ,&layout);
         int N = layout.size();
         std::vector<Type *> entry_types;
+        size_t offset = 0;
+        unsigned maxalign = 1;
         
         unsigned unionAlign = 0; //minimum union alignment
         Type * unionType = NULL; //type with the largest alignment constraint
         size_t unionAlignSz = 0; //size of type with largest alignment contraint
         size_t unionSz   = 0;    //allocation size of the largest member
+        unsigned unionRequested = 0; //largest alignment requested by a member of the union
+        int unionBegin = 0; //first entry of the current union
                                  
         for(int i = 0; i < N; i++) {
             Obj v;
@@ -264,8 +441,12 @@ struct CCallingConv {
             v.obj("type",&vt);
             
             Type * fieldtype = GetType(&vt)->type;
+            unsigned requested = std::max((unsigned) v.number("alignment"), GetRequestedAlignment(&vt));
             bool inunion = v.boolean("inunion");
             if(inunion) {
+                if(unionType == NULL)
+                    unionBegin = i;
+                unionRequested = std::max(unionRequested,requested);
                 unsigned align = C->td->getABITypeAlignment(fieldtype);
                 if(align >= unionAlign) { // orequal is to make sure we have a non-null type even if it is a 0-sized struct
                     unionAlign = align;
@@ -288,16 +469,31 @@ struct CCallingConv {
                         size_t diff = unionSz - unionAlignSz;
                         union_types.push_back(ArrayType::get(Type::getInt8Ty(*C->ctx),diff));
                     }
-                    entry_types.push_back(StructType::get(*C->ctx,union_types));
+                    int index = AddStructField(&entry_types,&offset,&maxalign,StructType::get(*C->ctx,union_types),unionRequested);
+                    for(int j = unionBegin; j <= i; j++) {
+                        Obj member;
+                        layout.objAt(j,&member);
+                        lua_pushnumber(L,index);
+                        member.setfield("llvmallocation");
+                    }
                     unionAlign = 0;
                     unionType = NULL;
                     unionAlignSz = 0;
                     unionSz = 0;
+                    unionRequested = 0;
                 }
             } else {
-                entry_types.push_back(fieldtype);
+                int index = AddStructField(&entry_types,&offset,&maxalign,fieldtype,requested);
+                lua_pushnumber(L,index);
+                v.setfield("llvmallocation");
             }
         }
+        //pad the end so that arrays of this struct keep each element aligned
+        Obj structlayout;
+        typ->obj("cachedlayout",&structlayout);
+        unsigned structalign = structlayout.number("alignment");
+        if(structalign > maxalign && RoundUp(offset,structalign) > RoundUp(offset,maxalign))
+            entry_types.push_back(ArrayType::get(Type::getInt8Ty(*C->ctx),RoundUp(offset,structalign) - offset));
         st->setBody(entry_types);
         DEBUG_ONLY(T) {
             printf("Struct Layout Is:\n");
@@ -477,7 +673,7 @@ struct CCallingConv {
             for(int i = 0; i < N; i++) {
                 Obj entry;
                 layout.objAt(i,&entry);
-                int allocation = entry.number("allocation");
+                int allocation = entry.number("llvmallocation");
                 size_t structoffset = sl->getElementOffset(allocation);
                 Obj entrytype;
                 entry.obj("type",&entrytype);
@@ -817,6 +1013,172 @@ struct CCallingConv {
         return FunctionType::get(rt,arguments,isvararg);
     }
     
+    //the internal convention used for calls between terra functions, which never escape to C:
+    //functions are fastcc, aggregates of up to FAST_AGGREGATE_LIMIT bytes are passed and returned as first-class values
+    //(so LLVM can keep them in registers), larger ones through a pointer to a copy owned by the caller.
+    //multiple return values are returned together as one literal struct
+    enum { FAST_AGGREGATE_LIMIT = 32 };
+
+    bool IsFastMemory(Type * t) {
+        return t->isAggregateType() && C->td->getTypeAllocSize(t) > FAST_AGGREGATE_LIMIT;
+    }
+    Type * FastReturnType(Obj * ftype) {
+        Obj returns;
+        ftype->obj("returns",&returns);
+        int N = returns.size();
+        if(N == 0)
+            return Type::getVoidTy(*C->ctx);
+        std::vector<Type *> types;
+        for(int i = 0; i < N; i++) {
+            Obj r;
+            returns.objAt(i,&r);
+            types.push_back(GetType(&r)->type);
+        }
+        return (N == 1) ? types[0] : StructType::get(*C->ctx,types);
+    }
+    FunctionType * CreateFastFunctionType(Obj * ftype) {
+        Obj params;
+        ftype->obj("parameters",&params);
+        std::vector<Type *> arguments;
+        Type * rt = FastReturnType(ftype);
+        if(IsFastMemory(rt)) {
+            arguments.push_back(Ptr(rt));
+            rt = Type::getVoidTy(*C->ctx);
+        }
+        int N = params.size();
+        for(int i = 0; i < N; i++) {
+            Obj p;
+            params.objAt(i,&p);
+            Type * t = GetType(&p)->type;
+            arguments.push_back(IsFastMemory(t) ? Ptr(t) : t);
+        }
+        return FunctionType::get(rt,arguments,false);
+    }
+    Function * CreateFastFunction(Obj * ftype, const char * name) {
+        Function * fn = Function::Create(CreateFastFunctionType(ftype), Function::ExternalLinkage, name, C->m);
+        fn->setCallingConv(CallingConv::Fast);
+        return fn;
+    }
+    void EmitFastEntry(Obj * ftype, Function * func, std::vector<Value *> * variables) {
+        Function::arg_iterator ai = func->arg_begin();
+        if(IsFastMemory(FastReturnType(ftype)))
+            ++ai; //the caller's result buffer
+        for(size_t i = 0; i < variables->size(); i++, ++ai) {
+            Value * v = (*variables)[i];
+            if(IsFastMemory(cast<PointerType>(v->getType())->getElementType()))
+                B->CreateStore(B->CreateLoad(ai),v);
+            else
+                B->CreateStore(ai,v);
+        }
+    }
+    void EmitFastReturn(Obj * ftype, Function * func, std::vector<Value *> * results) {
+        Type * rt = FastReturnType(ftype);
+        if(results->size() == 0) {
+            B->CreateRetVoid();
+            return;
+        }
+        Value * result;
+        if(results->size() == 1) {
+            result = (*results)[0];
+        } else {
+            result = UndefValue::get(rt);
+            for(size_t i = 0; i < results->size(); i++)
+                result = B->CreateInsertValue(result,(*results)[i],i);
+        }
+        if(IsFastMemory(rt)) {
+            B->CreateStore(result,func->arg_begin());
+            B->CreateRetVoid();
+        } else {
+            B->CreateRet(result);
+        }
+    }
+    //returns values in the same form as EmitCall: the result for one return value, a pointer to a struct of results for several
+    Value * EmitFastCall(Obj * ftype, Function * callee, std::vector<Value *> * actuals) {
+        Type * rt = FastReturnType(ftype);
+        bool memoryreturn = IsFastMemory(rt);
+        std::vector<Value *> arguments;
+        if(memoryreturn)
+            arguments.push_back(CreateAlloca(rt));
+        for(size_t i = 0; i < actuals->size(); i++) {
+            Value * actual = (*actuals)[i];
+            if(IsFastMemory(actual->getType())) {
+                Value * scratch = CreateAlloca(actual->getType());
+                B->CreateStore(actual,scratch);
+                arguments.push_back(scratch);
+            } else {
+                arguments.push_back(actual);
+            }
+        }
+        CallInst * call = B->CreateCall(callee, arguments);
+        call->setCallingConv(CallingConv::Fast);
+
+        Obj returns;
+        ftype->obj("returns",&returns);
+        int nreturns = returns.size();
+        if(nreturns == 0)
+            return call;
+        if(memoryreturn)
+            return (nreturns == 1) ? (Value*) B->CreateLoad(arguments[0]) : arguments[0];
+        if(nreturns == 1)
+            return call;
+        Value * aggregate = CreateAlloca(rt);
+        B->CreateStore(call,aggregate);
+        return aggregate;
+    }
+    //return callee(actuals) from caller as a guaranteed tail call. the frame of caller is reused, so arguments that
+    //would be passed through a copy in that frame cannot be supported; returns false if one is present
+    bool EmitFastTailCall(Obj * ftype, Function * caller, Function * callee, std::vector<Value *> * actuals) {
+        Type * rt = FastReturnType(ftype);
+        bool memoryreturn = IsFastMemory(rt);
+        std::vector<Value *> arguments;
+        if(memoryreturn)
+            arguments.push_back(caller->arg_begin()); //the callee writes directly into our caller's result buffer
+        for(size_t i = 0; i < actuals->size(); i++) {
+            Value * actual = (*actuals)[i];
+            if(IsFastMemory(actual->getType()))
+                return false;
+            arguments.push_back(actual);
+        }
+        CallInst * call = B->CreateCall(callee, arguments);
+        call->setCallingConv(CallingConv::Fast);
+        call->setTailCall(true);
+        if(rt->isVoidTy() || memoryreturn)
+            B->CreateRetVoid();
+        else
+            B->CreateRet(call);
+        return true;
+    }
+    //a C-ABI function that forwards to the fast function fn, used where a terra function escapes to C or lua
+    Function * CreateCThunk(Obj * ftype, Function * fn, const char * name) {
+        Function * thunk = CreateFunction(ftype, name);
+        IRBuilder<> * oldB = B;
+        IRBuilder<> TB(BasicBlock::Create(*C->ctx,"entry",thunk));
+        B = &TB;
+
+        Obj params, returns;
+        ftype->obj("parameters",&params);
+        ftype->obj("returns",&returns);
+        std::vector<Value *> variables;
+        for(int i = 0; i < params.size(); i++) {
+            Obj p;
+            params.objAt(i,&p);
+            variables.push_back(CreateAlloca(GetType(&p)->type));
+        }
+        EmitEntry(ftype, thunk, &variables);
+        std::vector<Value *> actuals;
+        for(size_t i = 0; i < variables.size(); i++)
+            actuals.push_back(B->CreateLoad(variables[i]));
+        Value * result = EmitFastCall(ftype, fn, &actuals);
+        int nreturns = returns.size();
+        std::vector<Value *> results;
+        for(int i = 0; i < nreturns; i++)
+            results.push_back(EmitExtractReturn(result, nreturns, i));
+        EmitReturn(ftype, thunk, &results);
+
+        B = oldB;
+        return thunk;
+    }
+
     void EnsureTypeIsComplete(Obj * typ) {
         GetType(typ);
     }
@@ -831,7 +1193,35 @@ struct CCallingConv {
     }
 };
 
+//arrays of numbers become a ConstantDataArray of their element type, created directly from the memory of the cdata object;
+//this keeps large tables a single blob of data in the IR and still lets LLVM fold loads at constant indices
+static Constant * GetConstantDataArray(LLVMContext & ctx, Type * typ, const void * data) {
+    ArrayType * at = dyn_cast<ArrayType>(typ);
+    if(!at)
+        return NULL;
+    Type * et = at->getElementType();
+    size_t N = at->getNumElements();
+    if(et->isFloatTy())
+        return ConstantDataArray::get(ctx,ArrayRef<float>((const float*)data,N));
+    if(et->isDoubleTy())
+        return ConstantDataArray::get(ctx,ArrayRef<double>((const double*)data,N));
+    if(et->isIntegerTy()) {
+        switch(cast<IntegerType>(et)->getBitWidth()) {
+            case 8: return ConstantDataArray::get(ctx,ArrayRef<uint8_t>((const uint8_t*)data,N));
+            case 16: return ConstantDataArray::get(ctx,ArrayRef<uint16_t>((const uint16_t*)data,N));
+            case 32: return ConstantDataArray::get(ctx,ArrayRef<uint32_t>((const uint32_t*)data,N));
+            case 64: return ConstantDataArray::get(ctx,ArrayRef<uint64_t>((const uint64_t*)data,N));
+        }
+    }
+    return NULL;
+}
+
+static Constant * GetConstantExpression(CCallingConv * CC, Obj * v); //defined after TerraCompiler, which does the lowering
+static Constant * GetConstantExpressionValue(CCallingConv * CC, Obj * v);
+
 static Constant * GetConstant(CCallingConv * CC, Obj * v) {
+    if(v->hasfield("expression"))
+        return GetConstantExpression(CC,v);
     lua_State * L = CC->L;
     terra_CompilerState * C = CC->C;
     Obj t;
@@ -848,7 +1238,9 @@ static Constant * GetConstant(CCallingConv * CC, Obj * v) {
             lua_pop(L,1); // remove pointer
             size_t size = C->td->getTypeAllocSize(typ->type);
             size_t align = C->td->getPrefTypeAlignment(typ->type);
-            Constant * arr = ConstantDataArray::get(*C->ctx,ArrayRef<uint8_t>((uint8_t*)data,size));
+            Constant * arr = GetConstantDataArray(*C->ctx,typ->type,data);
+            if(!arr) //other aggregates are embedded as raw bytes
+                arr = ConstantDataArray::get(*C->ctx,ArrayRef<uint8_t>((uint8_t*)data,size));
             gv = new GlobalVariable(*C->m, arr->getType(),
                                     true, GlobalValue::PrivateLinkage,
                                     arr, "const");
@@ -895,9 +1287,13 @@ static GlobalVariable * GetGlobalVariable(CCallingConv * CC, Obj * global, const
         Constant * llvmconstant = UndefValue::get(typ);
         Obj constant;
         if(global->obj("initializer",&constant)) {
-            llvmconstant = GetConstant(CC,&constant);
+            //constant expressions are used as the initializer directly, so tables of pointers need no startup code
+            llvmconstant = (constant.hasfield("expression")) ? GetConstantExpressionValue(CC,&constant) : GetConstant(CC,&constant);
         }
         gv = new GlobalVariable(*CC->C->m, typ, false, GlobalValue::ExternalLinkage, llvmconstant, name);
+        unsigned alignment = std::max((unsigned) global->number("alignment"), CC->GetRequestedAlignment(&t));
+        if(alignment > 0)
+            gv->setAlignment(alignment);
         lua_pushlightuserdata(CC->L, gv);
         global->setfield("value");
         //TODO: eventually the initialization constant can be a constant expression that hasn't been defined yet
@@ -915,6 +1311,116 @@ static GlobalVariable * GetGlobalVariable(CCallingConv * CC, Obj * global, const
 
 static int terra_deletefunction(lua_State * L);
 
+//a native callback stub is shared by every function that calls the same lua function with the same type.
+//it is deleted (and the lua function released) once the callback object and all of these callers have been collected,
+//since lua finalizes newest first and the callback's handle is created after the handle of the first function that calls it
+struct CallbackStub {
+    Function * fn;
+    int luaref; //registry reference to the lua function called by the stub
+    int refs; //the callback object, plus each function whose code calls the stub
+};
+
+struct FunctionGCHandle {
+    Function * fn;
+    Function * thunk; //the C-ABI entry point forwarding to fn, if one was created
+    CallbackStub * stub; //for the handle of a native callback object, fn is stub->fn
+    std::vector<CallbackStub *> * callbacks; //stubs called by the code of fn, released after fn is deleted
+};
+
+//attach a userdata object to obj that will call terra_deletefunction
+//on fn when obj is GC'd in lua
+static FunctionGCHandle * AttachFunctionGCHandle(terra_State * T, Obj * obj, const char * field, Function * fn) {
+    lua_State * L = T->L;
+    FunctionGCHandle * gchandle = (FunctionGCHandle*) lua_newuserdata(L,sizeof(FunctionGCHandle));
+    gchandle->fn = fn;
+    gchandle->thunk = NULL;
+    gchandle->stub = NULL;
+    gchandle->callbacks = NULL;
+    if(luaL_newmetatable(L,"terra_gcfuncdefinition")) {
+        lua_pushlightuserdata(L,(void*)T);
+        lua_pushcclosure(L,terra_deletefunction,1);
+        lua_setfield(L,-2,"__gc");
+    }
+    lua_setmetatable(L,-2);
+    obj->setfield(field);
+    return gchandle;
+}
+
+//terra function definitions are compiled into "llvm_fastfunction" using the internal convention (CCallingConv::CreateFastFunction),
+//other functions (C functions, callbacks) only have a C-ABI "llvm_function"
+static bool UsesFastConvention(Obj * funcobj) {
+    if(!funcobj->hasfield("untypedtree"))
+        return false;
+    Obj ftype;
+    funcobj->obj("type",&ftype);
+    return !ftype.boolean("isvararg");
+}
+
+//the function holding the code of a definition
+static Function * GetBodyFunction(Obj * funcobj) {
+    Function * fn = (Function*) funcobj->ud("llvm_fastfunction");
+    return fn ? fn : (Function*) funcobj->ud("llvm_function");
+}
+
+//the C-ABI entry point of a definition whose body has already been created, used when it escapes terra code
+//(it is called from lua or C, saved to an object file, or its address is taken).
+//for fast functions this is a thunk created the first time it is needed
+static Function * GetCFunction(CCallingConv * CC, Obj * funcobj) {
+    Function * fn = (Function*) funcobj->ud("llvm_function");
+    if(fn)
+        return fn;
+    Function * body = (Function*) funcobj->ud("llvm_fastfunction");
+    assert(body);
+    Obj ftype;
+    funcobj->obj("type",&ftype);
+    fn = CC->CreateCThunk(&ftype, body, funcobj->string("name"));
+    lua_pushlightuserdata(CC->L,fn);
+    funcobj->setfield("llvm_function");
+    FunctionGCHandle * gchandle = (FunctionGCHandle*) funcobj->ud("llvm_gchandle");
+    assert(gchandle);
+    gchandle->thunk = fn;
+    //the body is optimized already unless it is still being compiled, in which case the thunk just calls it
+    if(!body->isDeclaration()) {
+        std::vector<Function *> scc(1,fn);
+        CC->C->mi->runOnSCC(scc);
+    }
+    CC->C->fpm->run(*fn);
+    return fn;
+}
+
+//declare a function from the lua C API (or one of the helpers below) and make sure the JIT can find it
+//the lua_State * is passed as an &int8 since generated code never looks inside it
+static Value * GetLuaAPIFunction(terra_CompilerState * C, const char * name, void * addr, Type * rt, Type * arg) {
+    std::vector<Type *> args;
+    args.push_back(Type::getInt8PtrTy(*C->ctx));
+    args.push_back(arg);
+    Constant * fn = C->m->getOrInsertFunction(name, FunctionType::get(rt, args, false));
+    GlobalValue * gv = cast<GlobalValue>(fn->stripPointerCasts());
+    if(!C->ee->getPointerToGlobalIfAvailable(gv))
+        C->ee->addGlobalMapping(gv, addr);
+    return fn;
+}
+
+//called by native callback stubs (see TerraCompiler::emitNativeCallback) to call a lua function from terra code
+//returns the lua_State the arguments are pushed onto, or NULL if the function cannot be called
+static lua_State * terra_beginluacallback(terra_State * T, int ref) {
+    if(!pthread_equal(pthread_self(), T->C->luathread)) {
+        //lua states are not thread safe, so calls from other threads (e.g. parallel workers) are dropped
+        fprintf(stderr,"error in lua callback: called from a thread other than the one running lua\n");
+        return NULL;
+    }
+    lua_rawgeti(T->L,LUA_REGISTRYINDEX,ref);
+    return T->L;
+}
+static void terra_finishluacallback(lua_State * L, int nargs) {
+    if(lua_pcall(L,nargs,0,0)) {
+        //terra code has no way to handle a lua error, and it is not safe to longjmp through its frames,
+        //so we report the error here and return to the caller
+        fprintf(stderr,"error in lua callback: %s\n",lua_tostring(L,-1));
+        lua_pop(L,1);
+    }
+}
+
 struct TerraCompiler {
     lua_State * L;
     terra_State * T;
@@ -924,8 +1430,20 @@ struct TerraCompiler {
     Obj funcobj;
     Function * func;
     TType * func_type;
+    bool fastfunction; //func uses the internal convention rather than the C ABI
     CCallingConv CC;
     
+    //hints from terralib.unroll/vectorize/interleave, consumed by a loop in the statement that follows them
+    struct LoopHints {
+        int unroll, vectorize, interleave;
+    } loopHints;
+    int annotatedloops; //loops given llvm.loop metadata, reported as stats.annotatedloops of the definition
+    
+    //debug info for this function, only generated when terralib.debuginfo is set
+    bool emitdebuginfo;
+    DIFile difile;
+    DISubprogram disubprogram;
+    
     TType * getType(Obj * v) {
         return CC.GetType(v);
     }
@@ -935,47 +1453,171 @@ struct TerraCompiler {
         return getType(&t);
     }
     
-    AllocaInst * allocVar(Obj * v) {
+    AllocaInst * allocVar(Obj * v, int argno = 0) {
         AllocaInst * a = CC.CreateAlloca(typeOfValue(v)->type,0,v->asstring("name"));
+        Obj t;
+        v->obj("type",&t);
+        unsigned alignment = CC.GetRequestedAlignment(&t);
+        if(alignment > a->getAlignment())
+            a->setAlignment(alignment);
+        if(emitdebuginfo && v->hasfield("linenumber"))
+            emitVariableDebugInfo(v, &t, a, argno);
         lua_pushlightuserdata(L,a);
         v->setfield("value");
         return a;
     }
     
-    void getOrCreateFunction(Obj * funcobj, Function ** rfn, TType ** rtyp) {
-        Function * fn = (Function *) funcobj->ud("llvm_function");
-        Obj ftype;
-        funcobj->obj("type",&ftype);
-        *rtyp = getType(&ftype);
+    bool debugInfoEnabled() {
+        lua_getfield(L, LUA_GLOBALSINDEX, "terra");
+        lua_getfield(L, -1, "debuginfo");
+        bool enabled = lua_toboolean(L, -1);
+        lua_pop(L, 2);
+        return enabled;
+    }
+    std::string typeName(Obj * typ) {
+        lua_getfield(L, LUA_GLOBALSINDEX, "tostring");
+        typ->push();
+        lua_call(L, 1, 1);
+        std::string r = lua_tostring(L, -1);
+        lua_pop(L, 1);
+        return r;
+    }
+    //one compile unit is created per DIBuilder, each source file gets a DIFile in it
+    DIFile getDIFile(const char * filename) {
+        if(!C->dibuilder) {
+            char cwd[4096];
+            if(!getcwd(cwd, sizeof(cwd)))
+                cwd[0] = '\0';
+            C->dibuilder = new DIBuilder(*C->m);
+            C->dibuilder->createCompileUnit(dwarf::DW_LANG_C99, filename, cwd, "terra", true, "", 0);
+            free(C->dibuilderdirectory);
+            C->dibuilderdirectory = strdup(cwd);
+        }
+        return C->dibuilder->createFile(filename, C->dibuilderdirectory);
+    }
+    DIType getDIType(Obj * typ) {
+        if(typ->hasfield("llvm_ditype"))
+            return DIType((MDNode*) typ->ud("llvm_ditype"));
+        DIBuilder * D = C->dibuilder;
+        DIType r;
+        Type * t = getType(typ)->type;
+        uint64_t bits = C->td->getTypeSizeInBits(t);
+        uint64_t align = C->td->getABITypeAlignment(t) * 8;
+        switch(typ->kind("kind")) {
+            case T_primitive: {
+                unsigned encoding;
+                switch(typ->kind("type")) {
+                    case T_float: encoding = dwarf::DW_ATE_float; break;
+                    case T_logical: encoding = dwarf::DW_ATE_boolean; break;
+                    default: encoding = typ->boolean("signed") ? dwarf::DW_ATE_signed : dwarf::DW_ATE_unsigned; break;
+                }
+                r = D->createBasicType(typeName(typ), bits, align, encoding);
+            } break;
+            case T_pointer: {
+                Obj base;
+                typ->obj("type",&base);
+                DIType baset;
+                //structs are only described by name through pointers, which keeps recursive types finite
+                if(base.kind("kind") == T_struct || base.kind("kind") == T_functype)
+                    baset = D->createStructType(difile, typeName(&base), difile, 0, 0, 0, 0, DIArray());
+                else
+                    baset = getDIType(&base);
+                r = D->createPointerType(baset, bits, align, typeName(typ));
+            } break;
+            case T_array: case T_vector: {
+                Obj base;
+                typ->obj("type",&base);
+                int N = typ->number("N");
+                Value * subscript = D->getOrCreateSubrange(0, N - 1);
+                DIArray subscripts = D->getOrCreateArray(subscript);
+                if(typ->kind("kind") == T_array)
+                    r = D->createArrayType(bits, align, getDIType(&base), subscripts);
+                else
+                    r = D->createVectorType(bits, align, getDIType(&base), subscripts);
+            } break;
+            case T_struct: {
+                Obj layout, entries;
+                typ->obj("cachedlayout",&layout);
+                layout.obj("entries",&entries);
+                const StructLayout * sl = C->td->getStructLayout(cast<StructType>(t));
+                std::vector<Value*> members;
+                int N = entries.size();
+                for(int i = 0; i < N; i++) {
+                    Obj entry, et;
+                    entries.objAt(i,&entry);
+                    entry.obj("type",&et);
+                    Type * elemt = getType(&et)->type;
+                    uint64_t offset = sl->getElementOffsetInBits(entry.number("llvmallocation"));
+                    members.push_back(D->createMemberType(difile, entry.asstring("key"), difile, 0, C->td->getTypeSizeInBits(elemt),
+                                                          C->td->getABITypeAlignment(elemt) * 8, offset, 0, getDIType(&et)));
+                }
+                r = D->createStructType(difile, typeName(typ), difile, 0, bits, align, 0, D->getOrCreateArray(members));
+            } break;
+            default: {
+                r = D->createBasicType(typeName(typ), bits, align, dwarf::DW_ATE_unsigned);
+            } break;
+        }
+        lua_pushlightuserdata(L, (MDNode*) r);
+        typ->setfield("llvm_ditype");
+        return r;
+    }
+    void initDebugInfo(Obj * typedtree) {
+        int line = typedtree->number("linenumber");
+        difile = getDIFile(funcobj.string("filename"));
+        DIType fntype = C->dibuilder->createSubroutineType(difile, C->dibuilder->getOrCreateArray(ArrayRef<Value*>()));
+        disubprogram = C->dibuilder->createFunction(difile, func->getName(), func->getName(), difile, line, fntype, false, true,
+#ifdef LLVM_3_2
+                                                    line,
+#endif
+                                                    0, true, func);
+        B->SetCurrentDebugLocation(DebugLoc::get(line, 0, disubprogram));
+    }
+    void setDebugPoint(Obj * obj) {
+        if(obj->hasfield("linenumber"))
+            B->SetCurrentDebugLocation(DebugLoc::get(obj->number("linenumber"), 0, disubprogram));
+    }
+    void emitVariableDebugInfo(Obj * v, Obj * typ, AllocaInst * a, int argno) {
+        unsigned tag = (argno > 0) ? dwarf::DW_TAG_arg_variable : dwarf::DW_TAG_auto_variable;
+        DIVariable var = C->dibuilder->createLocalVariable(tag, disubprogram, v->asstring("name"), difile, v->number("linenumber"),
+                                                           getDIType(typ), false, 0, argno);
+        Instruction * declare = C->dibuilder->insertDeclare(a, var, B->GetInsertBlock());
+        declare->setDebugLoc(DebugLoc::get(v->number("linenumber"), 0, disubprogram));
+    }
+    
+    //the function that holds the code for funcobj, fastcc for terra definitions (see UsesFastConvention)
+    Function * getOrCreateBodyFunction(Obj * funcobj) {
+        Function * fn = GetBodyFunction(funcobj);
         if(!fn) {
+            Obj ftype;
+            funcobj->obj("type",&ftype);
             const char * name = funcobj->string("name");
-            
-            fn = CC.CreateFunction(&ftype, name);
+            bool fast = UsesFastConvention(funcobj);
+            fn = (fast) ? CC.CreateFastFunction(&ftype, name) : CC.CreateFunction(&ftype, name);
             
             if(funcobj->boolean("alwaysinline")) {
                 fn->ADDFNATTR(AlwaysInline);
             }
             lua_pushlightuserdata(L,fn);
-            funcobj->setfield("llvm_function");
-
-            //attach a userdata object to the function that will call terra_deletefunction 
-            //when the function variant is GC'd in lua
-            Function** gchandle = (Function**) lua_newuserdata(L,sizeof(Function**));
-            *gchandle = fn;
-            if(luaL_newmetatable(L,"terra_gcfuncdefinition")) {
-                lua_pushlightuserdata(L,(void*)T);
-                lua_pushcclosure(L,terra_deletefunction,1);
-                lua_setfield(L,-2,"__gc");
-            }
-            lua_setmetatable(L,-2);
-            funcobj->setfield("llvm_gchandle");
+            funcobj->setfield((fast) ? "llvm_fastfunction" : "llvm_function");
+
+            AttachFunctionGCHandle(T,funcobj,"llvm_gchandle",fn);
         }
-        *rfn = fn;
+        return fn;
+    }
+    //the C-ABI entry point for funcobj, for when its address escapes
+    void getOrCreateFunction(Obj * funcobj, Function ** rfn, TType ** rtyp) {
+        Obj ftype;
+        funcobj->obj("type",&ftype);
+        *rtyp = getType(&ftype);
+        getOrCreateBodyFunction(funcobj);
+        *rfn = GetCFunction(&CC,funcobj);
     }
     
     void run(terra_State * _T, int ref_table) {
         double begin = CurrentTimeInSeconds();
         T = _T;
+        memset(&loopHints,0,sizeof(LoopHints));
+        annotatedloops = 0;
         L = T->L;
         C = T->C;
         B = new IRBuilder<>(*C->ctx);
@@ -984,7 +1626,11 @@ struct TerraCompiler {
         lua_pushvalue(T->L,-2); //the original argument
         funcobj.initFromStack(T->L, ref_table);
         
-        getOrCreateFunction(&funcobj,&func,&func_type);
+        Obj ftype;
+        funcobj.obj("type",&ftype);
+        func_type = getType(&ftype);
+        func = getOrCreateBodyFunction(&funcobj);
+        fastfunction = UsesFastConvention(&funcobj);
         
         BB = BasicBlock::Create(*C->ctx,"entry",func);
         
@@ -996,18 +1642,22 @@ struct TerraCompiler {
         funcobj.obj("typedtree",&typedtree);
         typedtree.obj("parameters",&parameters);
         
-        Obj ftype;
-        funcobj.obj("type",&ftype);
+        emitdebuginfo = debugInfoEnabled();
+        if(emitdebuginfo)
+            initDebugInfo(&typedtree);
         
         int N = parameters.size();
         std::vector<Value *> parametervars;
         for(size_t i = 0; i < N; i++) {
             Obj p;
             parameters.objAt(i,&p);
-            parametervars.push_back(allocVar(&p));
+            parametervars.push_back(allocVar(&p, i + 1));
         }
         
-        CC.EmitEntry(&ftype, func, &parametervars);
+        if(fastfunction)
+            CC.EmitFastEntry(&ftype, func, &parametervars);
+        else
+            CC.EmitEntry(&ftype, func, &parametervars);
          
         Obj body;
         typedtree.obj("body",&body);
@@ -1021,15 +1671,121 @@ struct TerraCompiler {
         verifyFunction(*func);
         
         RecordTime(&funcobj, "llvmgen", begin);
+        if(annotatedloops > 0) {
+            Obj stats;
+            funcobj.obj("stats",&stats);
+            lua_pushnumber(L, annotatedloops);
+            stats.setfield("annotatedloops");
+        }
         //cleanup -- ensure we left the stack the way we started
         assert(lua_gettop(T->L) == ref_table);
         delete B;
     }
     
+    //generate a function with type ftype that pushes its arguments onto the lua stack and calls
+    //callback.luafunction with lua_pcall. The stub is cached on the callback object, which the typechecker
+    //keeps per (lua function, type) pair. Only numbers, booleans, and pointers (as lightuserdata) are passed.
+    Function * emitNativeCallback(Obj * callback, Obj * ftype) {
+        Function * fn = (Function*) callback->ud("llvm_function");
+        if(!fn)
+            fn = createNativeCallback(callback, ftype);
+        addCallbackUse((FunctionGCHandle*) callback->ud("llvm_gchandle"));
+        return fn;
+    }
+    //the function being compiled keeps the stub alive until its own code is deleted
+    void addCallbackUse(FunctionGCHandle * callbackhandle) {
+        CallbackStub * stub = callbackhandle->stub;
+        assert(stub);
+        if(!func) { //a constant expression, which can end up in the initializer of a global that lives as long as the module
+            stub->refs++;
+            return;
+        }
+        FunctionGCHandle * gchandle = (FunctionGCHandle*) funcobj.ud("llvm_gchandle");
+        assert(gchandle);
+        if(!gchandle->callbacks)
+            gchandle->callbacks = new std::vector<CallbackStub *>();
+        std::vector<CallbackStub *> & callbacks = *gchandle->callbacks;
+        if(std::find(callbacks.begin(), callbacks.end(), stub) == callbacks.end()) {
+            callbacks.push_back(stub);
+            stub->refs++;
+        }
+    }
+    Function * createNativeCallback(Obj * callback, Obj * ftype) {
+        Function * fn = CC.CreateFunction(ftype, "luacallback");
+        fn->setLinkage(GlobalValue::InternalLinkage);
+        lua_pushlightuserdata(L,fn);
+        callback->setfield("llvm_function");
+        
+        //anchor the lua function in the registry so the stub can find it, the reference is released
+        //(and the stub deleted) when the callback object and every function that calls the stub are collected
+        FunctionGCHandle * gchandle = AttachFunctionGCHandle(T,callback,"llvm_gchandle",fn);
+        callback->pushfield("luafunction");
+        int ref = luaL_ref(L,LUA_REGISTRYINDEX);
+        gchandle->stub = new CallbackStub();
+        gchandle->stub->fn = fn;
+        gchandle->stub->luaref = ref;
+        gchandle->stub->refs = 1;
+        
+        IRBuilder<> CB(BasicBlock::Create(*C->ctx,"entry",fn));
+        Type * int32Ty = Type::getInt32Ty(*C->ctx);
+        Type * doubleTy = Type::getDoubleTy(*C->ctx);
+        Type * voidTy = Type::getVoidTy(*C->ctx);
+        Type * ptrTy = Type::getInt8PtrTy(*C->ctx);
+        //the lua_State is looked up when the stub runs rather than baked into the code
+        Constant * terrastate = ConstantExpr::getIntToPtr(ConstantInt::get(C->td->getIntPtrType(*C->ctx), (intptr_t) T), ptrTy);
+        
+        Value * begin = GetLuaAPIFunction(C, "terra_beginluacallback", (void*) &terra_beginluacallback, ptrTy, int32Ty);
+        Value * state = CB.CreateCall2(begin, terrastate, ConstantInt::get(int32Ty, ref));
+        BasicBlock * callblock = BasicBlock::Create(*C->ctx,"call",fn);
+        BasicBlock * skipblock = BasicBlock::Create(*C->ctx,"skip",fn);
+        CB.CreateCondBr(CB.CreateIsNull(state), skipblock, callblock);
+        CB.SetInsertPoint(skipblock);
+        CB.CreateRetVoid();
+        CB.SetInsertPoint(callblock);
+        
+        Obj params;
+        ftype->obj("parameters",&params);
+        int N = params.size();
+        Function::arg_iterator ai = fn->arg_begin();
+        for(int i = 0; i < N; i++, ++ai) {
+            Obj p;
+            params.objAt(i,&p);
+            TType * t = getType(&p);
+            Value * v = ai;
+            if(t->type->isPointerTy()) {
+                Value * push = GetLuaAPIFunction(C, "lua_pushlightuserdata", (void*) &lua_pushlightuserdata, voidTy, ptrTy);
+                CB.CreateCall2(push, state, CB.CreateBitCast(v, ptrTy));
+            } else if(t->islogical) {
+                Value * push = GetLuaAPIFunction(C, "lua_pushboolean", (void*) &lua_pushboolean, voidTy, int32Ty);
+                CB.CreateCall2(push, state, CB.CreateZExt(CB.CreateICmpNE(v, ConstantInt::get(t->type, 0)), int32Ty));
+            } else {
+                if(t->type->isIntegerTy()) {
+                    v = (t->issigned) ? CB.CreateSIToFP(v, doubleTy) : CB.CreateUIToFP(v, doubleTy);
+                } else if(t->type->isFloatTy()) {
+                    v = CB.CreateFPExt(v, doubleTy);
+                }
+                Value * push = GetLuaAPIFunction(C, "lua_pushnumber", (void*) &lua_pushnumber, voidTy, doubleTy);
+                CB.CreateCall2(push, state, v);
+            }
+        }
+        
+        Value * finish = GetLuaAPIFunction(C, "terra_finishluacallback", (void*) &terra_finishluacallback, voidTy, int32Ty);
+        CB.CreateCall2(finish, state, ConstantInt::get(int32Ty, N));
+        CB.CreateRetVoid();
+        
+        DEBUG_ONLY(T) {
+            fn->dump();
+        }
+        verifyFunction(*fn);
+        return fn;
+    }
+    
     Value * emitUnary(Obj * exp, Obj * ao) {
+        return emitUnaryOp(exp,emitExp(ao));
+    }
+    Value * emitUnaryOp(Obj * exp, Value * a) {
         TType * t = typeOfValue(exp);
         Type * baseT = getPrimitiveType(t);
-        Value * a = emitExp(ao);
         T_Kind kind = exp->kind("operator");
         switch(kind) {
             case T_not:
@@ -1139,6 +1895,36 @@ if(baseT->isIntegerTy() || t->type->isPointerTy()) { \
             return NULL;
         }
     }
+    //vectors of pointers only exist to address gathers and scatters,
+    //so their operations are emitted one lane at a time
+    bool isVectorOfPointers(Type * t) {
+        return t->isVectorTy() && cast<VectorType>(t)->getElementType()->isPointerTy();
+    }
+    Value * emitVectorPointerArith(T_Kind kind, Value * pointers, Value * numbers) {
+        VectorType * vt = cast<VectorType>(pointers->getType());
+        Value * result = UndefValue::get(vt);
+        for(unsigned i = 0; i < vt->getNumElements(); i++) {
+            Value * idx = ConstantInt::get(Type::getInt32Ty(*C->ctx), i);
+            Value * p = emitPointerArith(kind, B->CreateExtractElement(pointers, idx), B->CreateExtractElement(numbers, idx));
+            result = B->CreateInsertElement(result, p, idx);
+        }
+        return result;
+    }
+    Value * emitVectorOfPointersCast(TType * toT, Value * v) {
+        VectorType * vt = cast<VectorType>(toT->type);
+        Type * elemTy = vt->getElementType();
+        Value * result = UndefValue::get(vt);
+        for(unsigned i = 0; i < vt->getNumElements(); i++) {
+            Value * idx = ConstantInt::get(Type::getInt32Ty(*C->ctx), i);
+            Value * e = B->CreateExtractElement(v, idx);
+            if(e->getType()->isPointerTy())
+                e = (elemTy->isPointerTy()) ? B->CreateBitCast(e, elemTy) : B->CreatePtrToInt(e, elemTy);
+            else
+                e = B->CreateIntToPtr(e, elemTy);
+            result = B->CreateInsertElement(result, e, idx);
+        }
+        return result;
+    }
     Value * emitPointerSub(TType * t, Value * a, Value * b) {
         return B->CreatePtrDiff(a, b);
     }
@@ -1167,6 +1953,11 @@ if(baseT->isIntegerTy() || t->type->isPointerTy()) { \
         //ok, we have eager operators, lets evalute the arguments then emit
         Value * a = emitExp(ao);
         Value * b = emitExp(bo);
+        return emitBinaryOp(exp,ao,bo,a,b);
+    }
+    Value * emitBinaryOp(Obj * exp, Obj * ao, Obj * bo, Value * a, Value * b) {
+        TType * t = typeOfValue(exp);
+        T_Kind kind = exp->kind("operator");
 
         Obj aot;
         ao->obj("type",&aot);
@@ -1175,6 +1966,12 @@ if(baseT->isIntegerTy() || t->type->isPointerTy()) { \
         //CC.EnsureTypeIsComplete(at) (not needed because typeOfValue(ao) ensure the type is complete)
         
         //check for pointer arithmetic first pointer arithmetic first
+        if(isVectorOfPointers(at->type) && (kind == T_add || kind == T_sub)) {
+            Obj ptrTy;
+            aot.obj("type",&ptrTy);
+            EnsurePointsToCompleteType(&ptrTy);
+            return emitVectorPointerArith(kind, a, b);
+        }
         if(at->type->isPointerTy() && (kind == T_add || kind == T_sub)) {
             EnsurePointsToCompleteType(&aot);
             if(bt->type->isPointerTy()) {
@@ -1232,6 +2029,39 @@ if(baseT->isIntegerTy()) { \
 #undef RETURN_OP
 #undef RETURN_SOP
     }
+    Value * emitCast(Obj * exp, Value * v) {
+        Obj to,from;
+        exp->obj("to",&to);
+        exp->obj("from",&from);
+        TType * fromT = getType(&from);
+        TType * toT = getType(&to);
+        if(fromT->type->isStructTy()) {
+            return emitStructCast(exp,fromT,&to,toT,v);
+        } else if(fromT->type->isArrayTy()) {
+            return emitArrayToPointer(fromT,toT,v);
+        } else if(fromT->type->isPointerTy()) {
+            if(toT->type->isVectorTy()) {
+                return emitBroadcast(fromT, toT, v);
+            } else if(toT->type->isPointerTy()) {
+                return B->CreateBitCast(v, toT->type);
+            } else {
+                assert(toT->type->isIntegerTy());
+                return B->CreatePtrToInt(v, toT->type);
+            }
+        } else if(toT->type->isPointerTy()) {
+            assert(fromT->type->isIntegerTy());
+            return B->CreateIntToPtr(v, toT->type);
+        } else if(toT->type->isVectorTy()) {
+            if(isVectorOfPointers(fromT->type) || isVectorOfPointers(toT->type))
+                return emitVectorOfPointersCast(toT,v);
+            else if(fromT->type->isVectorTy())
+                return emitPrimitiveCast(fromT,toT,v);
+            else
+                return emitBroadcast(fromT, toT, v);
+        } else {
+            return emitPrimitiveCast(fromT,toT,v);
+        }
+    }
     Value * emitStructCast(Obj * exp, TType * from, Obj * toObj, TType * to, Value * input) {
         //allocate memory to hold input variable
         Obj structvariable;
@@ -1319,12 +2149,35 @@ if(baseT->isIntegerTy()) { \
         
     }
     Value * emitBroadcast(TType * fromT, TType * toT, Value * v) {
-        Value * result = UndefValue::get(toT->type);
+        //a single insert followed by a zero shuffle is the splat pattern the backends match to broadcast instructions
         VectorType * vt = cast<VectorType>(toT->type);
         Type * integerType = Type::getInt32Ty(*C->ctx);
-        for(int i = 0; i < vt->getNumElements(); i++)
-            result = B->CreateInsertElement(result, v, ConstantInt::get(integerType, i));
-        return result;
+        Value * lane0 = B->CreateInsertElement(UndefValue::get(vt), v, ConstantInt::get(integerType, 0));
+        Value * zeros = ConstantAggregateZero::get(VectorType::get(integerType, vt->getNumElements()));
+        return B->CreateShuffleVector(lane0, UndefValue::get(vt), zeros);
+    }
+    Value * emitShuffle(Obj * exp) {
+        Obj vectors,indices;
+        exp->obj("vectors",&vectors);
+        exp->obj("indices",&indices);
+        std::vector<Value*> values;
+        for(int i = 0; i < vectors.size(); i++) {
+            Obj v;
+            vectors.objAt(i,&v);
+            values.push_back(emitExp(&v));
+        }
+        Value * a = values[0];
+        Value * b = (values.size() > 1) ? values[1] : UndefValue::get(a->getType());
+        //indices are a list of numbers, so read them directly from the lua table
+        std::vector<Constant*> mask;
+        indices.push();
+        for(int i = 0; i < indices.size(); i++) {
+            lua_rawgeti(L,-1,i+1);
+            mask.push_back(ConstantInt::get(Type::getInt32Ty(*C->ctx), (int) lua_tonumber(L,-1)));
+            lua_pop(L,1);
+        }
+        lua_pop(L,1);
+        return B->CreateShuffleVector(a, b, ConstantVector::get(mask));
     }
     Value * emitStructSelect(Obj * structType, Value * structPtr, int index) {
 
@@ -1339,7 +2192,7 @@ if(baseT->isIntegerTy()) { \
         Obj entry;
         layout.objAt(index,&entry);
         
-        int allocindex = entry.number("allocation");
+        int allocindex = entry.number("llvmallocation"); //index after LayoutStruct has added any alignment padding
         
         Value * addr = B->CreateConstGEP2_32(structPtr,0,allocindex);
         
@@ -1530,7 +2383,7 @@ if(baseT->isIntegerTy()) { \
                         exp->pushfield("value");
                         size_t len;
                         const char * rawstr = lua_tolstring(L,-1,&len);
-                        Value * str = B->CreateGlobalString(StringRef(rawstr,len));
+                        Value * str = createGlobalString(StringRef(rawstr,len));
                         lua_pop(L,1);
                         return  B->CreateBitCast(str, pt);
                     } else {
@@ -1551,6 +2404,11 @@ if(baseT->isIntegerTy()) { \
                 exp->obj("type",&type);
                 type.obj("type", &objType);
                 
+                Obj callback;
+                if(exp->obj("nativecallback",&callback)) {
+                    return emitNativeCallback(&callback,&objType);
+                }
+                
                 FunctionType * fntyp = cast<FunctionType>(getType(&objType)->type);
                 assert(fntyp);
                 Function * fn = Function::Create(fntyp, Function::ExternalLinkage,"", C->m);
@@ -1560,35 +2418,8 @@ if(baseT->isIntegerTy()) { \
             } break;
             case T_cast: {
                 Obj a;
-                Obj to,from;
                 exp->obj("expression",&a);
-                exp->obj("to",&to);
-                exp->obj("from",&from);
-                TType * fromT = getType(&from);
-                TType * toT = getType(&to);
-                Value * v = emitExp(&a);
-                if(fromT->type->isStructTy()) {
-                    return emitStructCast(exp,fromT,&to,toT,v);
-                } else if(fromT->type->isArrayTy()) {
-                    return emitArrayToPointer(fromT,toT,v);
-                } else if(fromT->type->isPointerTy()) {
-                    if(toT->type->isPointerTy()) {
-                        return B->CreateBitCast(v, toT->type);
-                    } else {
-                        assert(toT->type->isIntegerTy());
-                        return B->CreatePtrToInt(v, toT->type);
-                    }
-                } else if(toT->type->isPointerTy()) {
-                    assert(fromT->type->isIntegerTy());
-                    return B->CreateIntToPtr(v, toT->type);
-                } else if(toT->type->isVectorTy()) {
-                    if(fromT->type->isVectorTy())
-                        return emitPrimitiveCast(fromT,toT,v);
-                    else
-                        return emitBroadcast(fromT, toT, v);
-                } else {
-                    return emitPrimitiveCast(fromT,toT,v);
-                }
+                return emitCast(exp,emitExp(&a));
             } break;
             case T_sizeof: {
                 Obj typ;
@@ -1663,11 +2494,232 @@ if(baseT->isIntegerTy()) { \
                 Value * fn = C->m->getOrInsertFunction(name, fntype);
                 return B->CreateCall(fn, values);
             }
+            case T_gather: {
+                return emitGather(exp);
+            } break;
+            case T_shuffle: {
+                return emitShuffle(exp);
+            } break;
+            case T_atomic: {
+                return emitAtomic(exp);
+            } break;
             default: {
                 assert(!"NYI - exp");
             } break;
         }
     }
+    //same as IRBuilder::CreateGlobalString, but it does not need an insertion point, so constant expressions can use it
+    Constant * createGlobalString(StringRef str) {
+        Constant * data = ConstantDataArray::getString(*C->ctx,str);
+        GlobalVariable * gv = new GlobalVariable(*C->m, data->getType(), true, GlobalValue::PrivateLinkage, data, "");
+        gv->setUnnamedAddr(true);
+        return gv;
+    }
+    
+    //constant expressions (terralib.constant(`exp)) are lowered directly to LLVM constants.
+    //the builder has no insertion point, so the emit functions shared with normal code generation fold to constants.
+    //as in emitExp, lvalues are addresses (e.g. of a global); rvalues that are indexed or selected from are first
+    //placed in a private constant global, and reads are folded from the initializer of the global they address.
+    std::vector<GlobalVariable *> constanttemporaries;
+    
+    void initConstantExpression(terra_State * _T, IRBuilder<> * builder) {
+        T = _T;
+        L = T->L;
+        C = T->C;
+        B = builder;
+        CC.init(T, C, B);
+        func = NULL;
+        fastfunction = false;
+        emitdebuginfo = false;
+        memset(&loopHints,0,sizeof(LoopHints));
+        annotatedloops = 0;
+    }
+    void finishConstantExpression() {
+        for(size_t i = 0; i < constanttemporaries.size(); i++) {
+            GlobalVariable * gv = constanttemporaries[i];
+            gv->removeDeadConstantUsers();
+            if(gv->use_empty())
+                gv->eraseFromParent();
+        }
+        constanttemporaries.clear();
+    }
+    void constantError(Obj * exp, const char * what) {
+        terra_reporterror(T,"%s:%d: %s cannot be used in a constant expression\n",exp->string("filename"),(int)exp->number("linenumber"),what);
+    }
+    Constant * asConstant(Obj * exp, Value * v) {
+        Constant * c = dyn_cast<Constant>(v);
+        if(!c)
+            constantError(exp,"this expression");
+        return c;
+    }
+    Constant * materializeConstant(Constant * v) {
+        GlobalVariable * gv = new GlobalVariable(*C->m, v->getType(), true, GlobalValue::PrivateLinkage, v, "constanttemp");
+        constanttemporaries.push_back(gv);
+        return gv;
+    }
+    Constant * loadConstant(Obj * exp, Constant * addr) {
+        Constant * v = ConstantFoldLoadFromConstPtr(addr, C->td);
+        if(!v) //only the contents of constant globals are known at compile time
+            constantError(exp,"reading from a global variable");
+        return v;
+    }
+    void emitConstantList(Obj * paramlist, std::vector<Constant *> * results) {
+        Obj params, fncall;
+        if(paramlist->obj("fncall",&fncall))
+            constantError(&fncall,"a function call");
+        paramlist->obj("expressions",&params);
+        int N = params.size();
+        for(int i = 0; i < N; i++) {
+            Obj v;
+            params.objAt(i,&v);
+            results->push_back(emitConstantExp(&v));
+        }
+    }
+    Constant * emitConstantStructCast(Obj * exp, Obj * toObj, TType * to, Constant * input) {
+        //the entries select from the structvariable, which is bound to the address of the input
+        Obj structvariable;
+        exp->obj("structvariable",&structvariable);
+        lua_pushlightuserdata(L,materializeConstant(input));
+        structvariable.setfield("llvm_constantaddress");
+        
+        CC.EnsureTypeIsComplete(toObj);
+        Obj layout, entries;
+        GetStructEntries(toObj,&layout);
+        exp->obj("entries",&entries);
+        Constant * result = Constant::getNullValue(to->type);
+        int N = entries.size();
+        for(int i = 0; i < N; i++) {
+            Obj entry, value, field;
+            entries.objAt(i,&entry);
+            entry.obj("value",&value);
+            layout.objAt(entry.number("index"),&field);
+            if(field.boolean("inunion"))
+                constantError(exp,"initializing a union");
+            unsigned allocindex = field.number("llvmallocation");
+            result = ConstantExpr::getInsertValue(result, emitConstantExp(&value), allocindex);
+        }
+        return result;
+    }
+    Constant * emitConstantExp(Obj * exp) {
+        switch(exp->kind("kind")) {
+            case T_literal: case T_constant: case T_sizeof: {
+                return asConstant(exp,emitExp(exp));
+            } break;
+            case T_var: {
+                Obj def;
+                exp->obj("definition",&def);
+                if(def.hasfield("isglobal"))
+                    return GetGlobalVariable(&CC,&def,exp->asstring("name"));
+                Constant * addr = (Constant*) def.ud("llvm_constantaddress");
+                if(!addr)
+                    constantError(exp,"a local variable");
+                return addr;
+            } break;
+            case T_ltor: {
+                Obj e;
+                exp->obj("expression",&e);
+                return loadConstant(exp,emitConstantExp(&e));
+            } break;
+            case T_rtol: {
+                Obj e;
+                exp->obj("expression",&e);
+                return materializeConstant(emitConstantExp(&e));
+            } break;
+            case T_operator: {
+                Obj exps;
+                exp->obj("operands",&exps);
+                int N = exps.size();
+                if(N == 1) {
+                    Obj a;
+                    exps.objAt(0,&a);
+                    return asConstant(exp,emitUnaryOp(exp,emitConstantExp(&a)));
+                } else if(N == 2) {
+                    //and/or have no side effects here, so they do not need to be lazy
+                    Obj a,b;
+                    exps.objAt(0,&a);
+                    exps.objAt(1,&b);
+                    Constant * ca = emitConstantExp(&a);
+                    Constant * cb = emitConstantExp(&b);
+                    return asConstant(exp,emitBinaryOp(exp,&a,&b,ca,cb));
+                }
+                constantError(exp,"this operator");
+            } break;
+            case T_cast: {
+                Obj a,to,from;
+                exp->obj("expression",&a);
+                exp->obj("to",&to);
+                exp->obj("from",&from);
+                TType * toT = getType(&to);
+                Constant * v = emitConstantExp(&a);
+                if(getType(&from)->type->isStructTy())
+                    return emitConstantStructCast(exp,&to,toT,v);
+                return asConstant(exp,emitCast(exp,v));
+            } break;
+            case T_select: {
+                Obj obj,typ;
+                exp->obj("value",&obj);
+                obj.obj("type",&typ);
+                Constant * v = emitConstantExp(&obj);
+                int offset = exp->number("index");
+                if(exp->boolean("lvalue"))
+                    return asConstant(exp,emitStructSelect(&typ,v,offset));
+                return loadConstant(exp,asConstant(exp,emitStructSelect(&typ,materializeConstant(v),offset)));
+            } break;
+            case T_index: {
+                Obj value,idx,aggTypeO;
+                exp->obj("value",&value);
+                exp->obj("index",&idx);
+                value.obj("type",&aggTypeO);
+                TType * aggType = getType(&aggTypeO);
+                Constant * valueExp = emitConstantExp(&value);
+                Constant * idxExp = emitConstantExp(&idx);
+                if(aggType->type->isVectorTy())
+                    constantError(exp,"indexing a vector");
+                bool pa = exp->boolean("lvalue");
+                if(!pa)
+                    valueExp = materializeConstant(valueExp);
+                std::vector<Value*> idxs;
+                if(aggType->type->isPointerTy())
+                    EnsurePointsToCompleteType(&aggTypeO);
+                else
+                    idxs.push_back(ConstantInt::get(Type::getInt32Ty(*C->ctx),0));
+                idxs.push_back(idxExp);
+                Constant * result = asConstant(exp,B->CreateGEP(valueExp,idxs));
+                return (pa) ? result : loadConstant(exp,result);
+            } break;
+            case T_constructor: case T_arrayconstructor: {
+                Obj expressions;
+                exp->obj("expressions",&expressions);
+                std::vector<Constant *> values;
+                emitConstantList(&expressions,&values);
+                Constant * result = Constant::getNullValue(typeOfValue(exp)->type);
+                for(unsigned i = 0; i < values.size(); i++)
+                    result = ConstantExpr::getInsertValue(result, values[i], i);
+                return result;
+            } break;
+            case T_vectorconstructor: {
+                Obj expressions;
+                exp->obj("expressions",&expressions);
+                std::vector<Constant *> values;
+                emitConstantList(&expressions,&values);
+                return ConstantVector::get(values);
+            } break;
+            case T_typedexpressionlist: {
+                std::vector<Constant *> values;
+                emitConstantList(exp,&values);
+                if(values.size() == 0)
+                    constantError(exp,"an expression with no value");
+                return values[0];
+            } break;
+            case T_extractreturn: {
+                constantError(exp,"a function call");
+            } break;
+            default: {
+                constantError(exp,tkindtostr(exp->kind("kind")));
+            } break;
+        }
+        return NULL;
+    }
     BasicBlock * createBB(const char * name) {
         BasicBlock * bb = BasicBlock::Create(*C->ctx, name);
         return bb;
@@ -1683,6 +2735,182 @@ if(baseT->isIntegerTy()) { \
     Value * emitCond(Obj * cond) {
         return emitCond(emitExp(cond));
     }
+    //address of lane i of a gather or scatter, from a vector of pointers or relative to a pointer to a vector
+    Value * emitLaneAddress(Value * addresses, unsigned i) {
+        Value * idx = ConstantInt::get(Type::getInt32Ty(*C->ctx), i);
+        if(addresses->getType()->isVectorTy())
+            return B->CreateExtractElement(addresses, idx);
+        VectorType * vt = cast<VectorType>(cast<PointerType>(addresses->getType())->getElementType());
+        Value * base = B->CreateBitCast(addresses, PointerType::getUnqual(vt->getElementType()));
+        return B->CreateConstGEP1_32(base, i);
+    }
+    //LLVM has no target-independent gather/scatter, so each lane is accessed separately.
+    //Masked-off lanes are redirected to a stack slot rather than branched around so that the
+    //generated code stays straight-line; for gathers the slot holds the passthru value for that lane.
+    Value * emitGather(Obj * exp) {
+        Obj addressesObj,maskObj,passthruObj;
+        exp->obj("addresses",&addressesObj);
+        Value * addresses = emitExp(&addressesObj);
+        VectorType * vt = cast<VectorType>(typeOfValue(exp)->type);
+        Value * mask = NULL;
+        if(exp->obj("mask",&maskObj))
+            mask = emitCond(&maskObj);
+        Value * result = UndefValue::get(vt);
+        if(exp->obj("passthru",&passthruObj))
+            result = emitExp(&passthruObj);
+        if(!mask && !addresses->getType()->isVectorTy())
+            return B->CreateLoad(addresses);
+        Value * scratch = (mask) ? CC.CreateAlloca(vt->getElementType()) : NULL;
+        for(unsigned i = 0; i < vt->getNumElements(); i++) {
+            Value * idx = ConstantInt::get(Type::getInt32Ty(*C->ctx), i);
+            Value * addr = emitLaneAddress(addresses, i);
+            if(mask) {
+                B->CreateStore(B->CreateExtractElement(result, idx), scratch);
+                addr = B->CreateSelect(B->CreateExtractElement(mask, idx), addr, scratch);
+            }
+            result = B->CreateInsertElement(result, B->CreateLoad(addr), idx);
+        }
+        return result;
+    }
+    void recordLoopHint(Obj * stmt) {
+        const char * hint = stmt->string("hint");
+        int value = (int) stmt->number("value");
+        if(strcmp(hint,"unroll") == 0)
+            loopHints.unroll = value;
+        else if(strcmp(hint,"vectorize") == 0)
+            loopHints.vectorize = value;
+        else
+            loopHints.interleave = value;
+    }
+    void addLoopHint(std::vector<Value*> * ops, const char * name, int value) {
+        if(value > 0) {
+            Value * hint[] = { MDString::get(*C->ctx, name), ConstantInt::get(Type::getInt32Ty(*C->ctx), value) };
+            ops->push_back(MDNode::get(*C->ctx, hint));
+        }
+    }
+    //attach pending loop hints to the backedge of the loop as llvm.loop metadata.
+    //the first operand of the loop id is a reference to itself, which keeps each loop's id distinct
+    void emitLoopHints(Instruction * backedge) {
+        if(loopHints.unroll == 0 && loopHints.vectorize == 0 && loopHints.interleave == 0)
+            return;
+        MDNode * temp = MDNode::getTemporary(*C->ctx, ArrayRef<Value*>());
+        std::vector<Value*> ops;
+        ops.push_back(temp);
+        addLoopHint(&ops, "llvm.loop.unroll.count", loopHints.unroll);
+        addLoopHint(&ops, "llvm.loop.vectorize.width", loopHints.vectorize);
+        addLoopHint(&ops, "llvm.loop.interleave.count", loopHints.interleave);
+        MDNode * loopid = MDNode::get(*C->ctx, ops);
+        temp->replaceAllUsesWith(loopid);
+        MDNode::deleteTemporary(temp);
+        backedge->setMetadata("llvm.loop", loopid);
+        memset(&loopHints,0,sizeof(LoopHints));
+        annotatedloops++;
+    }
+    void emitPrefetch(Obj * stmt) {
+        Obj addressObj;
+        stmt->obj("address",&addressObj);
+        Value * addr = B->CreateBitCast(emitExp(&addressObj), Type::getInt8PtrTy(*C->ctx));
+        Type * i32 = Type::getInt32Ty(*C->ctx);
+        Type * params[] = { addr->getType(), i32, i32, i32 };
+        Value * fn = C->m->getOrInsertFunction("llvm.prefetch", FunctionType::get(Type::getVoidTy(*C->ctx), params, false));
+        Value * args[] = { addr,
+                           ConstantInt::get(i32, (int) stmt->number("rw")),
+                           ConstantInt::get(i32, (int) stmt->number("locality")),
+                           ConstantInt::get(i32, 1) }; //data cache
+        B->CreateCall(fn, args);
+    }
+    AtomicOrdering getAtomicOrdering(const char * name) {
+        if(strcmp(name,"monotonic") == 0)
+            return Monotonic;
+        else if(strcmp(name,"acquire") == 0)
+            return Acquire;
+        else if(strcmp(name,"release") == 0)
+            return Release;
+        else if(strcmp(name,"acq_rel") == 0)
+            return AcquireRelease;
+        else
+            return SequentiallyConsistent;
+    }
+    Value * emitAtomic(Obj * exp) {
+        const char * op = exp->string("operation");
+        AtomicOrdering ordering = getAtomicOrdering(exp->string("ordering"));
+        if(strcmp(op,"fence") == 0) {
+            B->CreateFence(ordering);
+            return NULL;
+        }
+        Obj addressObj,operands,ptrTy,elemTy;
+        exp->obj("address",&addressObj);
+        exp->obj("operands",&operands);
+        addressObj.obj("type",&ptrTy);
+        ptrTy.obj("type",&elemTy);
+        TType * et = getType(&elemTy);
+        Value * addr = emitExp(&addressObj);
+        std::vector<Value*> values;
+        for(int i = 0; i < operands.size(); i++) {
+            Obj o;
+            operands.objAt(i,&o);
+            values.push_back(emitExp(&o));
+        }
+        //atomic loads and stores must be naturally aligned
+        unsigned alignment = C->td->getTypeAllocSize(et->type);
+        if(strcmp(op,"load") == 0) {
+            LoadInst * l = B->CreateLoad(addr);
+            l->setAlignment(alignment);
+            l->setAtomic(ordering);
+            return l;
+        } else if(strcmp(op,"store") == 0) {
+            StoreInst * s = B->CreateStore(values[0],addr);
+            s->setAlignment(alignment);
+            s->setAtomic(ordering);
+            return NULL;
+        } else if(strcmp(op,"cmpxchg") == 0) {
+            return B->CreateAtomicCmpXchg(addr, values[0], values[1], ordering);
+        }
+        AtomicRMWInst::BinOp binop;
+        if(strcmp(op,"add") == 0)
+            binop = AtomicRMWInst::Add;
+        else if(strcmp(op,"sub") == 0)
+            binop = AtomicRMWInst::Sub;
+        else if(strcmp(op,"and") == 0)
+            binop = AtomicRMWInst::And;
+        else if(strcmp(op,"or") == 0)
+            binop = AtomicRMWInst::Or;
+        else if(strcmp(op,"xor") == 0)
+            binop = AtomicRMWInst::Xor;
+        else if(strcmp(op,"max") == 0)
+            binop = (et->issigned) ? AtomicRMWInst::Max : AtomicRMWInst::UMax;
+        else if(strcmp(op,"min") == 0)
+            binop = (et->issigned) ? AtomicRMWInst::Min : AtomicRMWInst::UMin;
+        else {
+            assert(strcmp(op,"xchg") == 0);
+            binop = AtomicRMWInst::Xchg;
+        }
+        return B->CreateAtomicRMW(binop, addr, values[0], ordering);
+    }
+    //lanes are stored in order, so when two lanes have the same address the higher lane wins
+    void emitScatter(Obj * stmt) {
+        Obj addressesObj,valueObj,maskObj;
+        stmt->obj("addresses",&addressesObj);
+        stmt->obj("value",&valueObj);
+        Value * addresses = emitExp(&addressesObj);
+        Value * value = emitExp(&valueObj);
+        VectorType * vt = cast<VectorType>(value->getType());
+        Value * mask = NULL;
+        if(stmt->obj("mask",&maskObj))
+            mask = emitCond(&maskObj);
+        if(!mask && !addresses->getType()->isVectorTy()) {
+            B->CreateStore(value, addresses);
+            return;
+        }
+        Value * scratch = (mask) ? CC.CreateAlloca(vt->getElementType()) : NULL;
+        for(unsigned i = 0; i < vt->getNumElements(); i++) {
+            Value * idx = ConstantInt::get(Type::getInt32Ty(*C->ctx), i);
+            Value * addr = emitLaneAddress(addresses, i);
+            if(mask)
+                addr = B->CreateSelect(B->CreateExtractElement(mask, idx), addr, scratch);
+            B->CreateStore(B->CreateExtractElement(value, idx), addr);
+        }
+    }
     Value * emitCond(Value * cond) {
         Type * resultType = Type::getInt1Ty(*C->ctx);
         if(cond->getType()->isVectorTy()) {
@@ -1740,19 +2968,49 @@ if(baseT->isIntegerTy()) { \
         call->obj("paramtypes",&paramtypes);
         call->obj("value",&func);
         
-        Value * fn = emitExp(&func);
-        
         Obj fnptrtyp;
         func.obj("type",&fnptrtyp);
         Obj fntyp;
         fnptrtyp.obj("type",&fntyp);
         
+        //direct calls to terra definitions use the internal convention, so they never need a C-ABI thunk
+        Obj definition;
+        if(func.kind("kind") == T_literal && func.obj("value",&definition) && UsesFastConvention(&definition)) {
+            Function * fn = getOrCreateBodyFunction(&definition);
+            std::vector<Value*> actuals;
+            emitParameterList(&paramlist,&actuals);
+            return CC.EmitFastCall(&fntyp, fn, &actuals);
+        }
+        
+        Value * fn = emitExp(&func);
+        
         std::vector<Value*> actuals;
         emitParameterList(&paramlist,&actuals);
         
         return CC.EmitCall(&fntyp,&paramtypes, fn, &actuals);
     }
     
+    //the typechecker has already ensured the statement is 'return tailcall f(...)' for a terra function f
+    //that returns exactly the types of this function
+    void emitTailCall(Obj * stmt) {
+        Obj exps, fncall, paramlist, callee, definition, fnptrtyp, fntyp;
+        stmt->obj("expressions",&exps);
+        exps.obj("fncall",&fncall);
+        fncall.obj("arguments",&paramlist);
+        fncall.obj("value",&callee);
+        callee.obj("value",&definition);
+        callee.obj("type",&fnptrtyp);
+        fnptrtyp.obj("type",&fntyp);
+        if(!C->guaranteedtailcalls)
+            terra_reporterror(T,"%s:%d: tailcall: terralib.usetailcalls must be set to true before the first function is compiled\n",stmt->string("filename"),(int)stmt->number("linenumber"));
+        if(!fastfunction || !UsesFastConvention(&definition))
+            terra_reporterror(T,"%s:%d: tailcall: only calls between terra functions can be tail calls\n",stmt->string("filename"),(int)stmt->number("linenumber"));
+        Function * fn = getOrCreateBodyFunction(&definition);
+        std::vector<Value*> actuals;
+        emitParameterList(&paramlist,&actuals);
+        if(!CC.EmitFastTailCall(&fntyp, func, fn, &actuals))
+            terra_reporterror(T,"%s:%d: tailcall: aggregates larger than %d bytes cannot be passed to a tail call, pass a pointer instead\n",stmt->string("filename"),(int)stmt->number("linenumber"),(int)CCallingConv::FAST_AGGREGATE_LIMIT);
+    }
     void emitReturnUndef() {
         Type * rt = func->getReturnType();
         if(rt->isVoidTy()) {
@@ -1825,18 +3083,37 @@ if(baseT->isIntegerTy()) { \
             }
             return;
         }
+        if(emitdebuginfo)
+            setDebugPoint(stmt);
         switch(kind) {
             case T_block: {
                 Obj stmts;
                 stmt->obj("statements",&stmts);
                 int N = stmts.size();
+                //hints recorded in this block only apply to loops in the statement that follows them
+                //(a numeric for is a block that declares its variables before the loop, so nested blocks do not clear them)
+                bool hintspending = false;
                 for(int i = 0; i < N; i++) {
                     Obj s;
                     stmts.objAt(i,&s);
+                    bool ishint = s.kind("kind") == T_loophint;
                     emitStmt(&s);
+                    if(ishint) {
+                        hintspending = true;
+                    } else if(hintspending) {
+                        memset(&loopHints,0,sizeof(LoopHints));
+                        hintspending = false;
+                    }
                 }
+                if(hintspending)
+                    memset(&loopHints,0,sizeof(LoopHints));
             } break;
             case T_return: {
+                if(stmt->boolean("tailcall")) {
+                    emitTailCall(stmt);
+                    BB = NULL;
+                    break;
+                }
                 Obj exps;
                 stmt->obj("expressions",&exps);
                 
@@ -1844,7 +3121,10 @@ if(baseT->isIntegerTy()) { \
                 emitParameterList(&exps, &results);
                 Obj ftype;
                 funcobj.obj("type",&ftype);
-                CC.EmitReturn(&ftype,func,&results);
+                if(fastfunction)
+                    CC.EmitFastReturn(&ftype,func,&results);
+                else
+                    CC.EmitReturn(&ftype,func,&results);
                 BB = NULL;
             } break;
             case T_label: {
@@ -1872,6 +3152,8 @@ if(baseT->isIntegerTy()) { \
                 Obj cond,body;
                 stmt->obj("condition",&cond);
                 stmt->obj("body",&body);
+                LoopHints hints = loopHints;
+                memset(&loopHints,0,sizeof(LoopHints)); //loops nested in the body do not get this loop's hints
                 BasicBlock * condBB = createAndInsertBB("condition");
                 
                 B->CreateBr(condBB);
@@ -1891,8 +3173,11 @@ if(baseT->isIntegerTy()) { \
                 
                 emitStmt(&body);
                 
-                if(BB)
-                    B->CreateBr(condBB);
+                if(BB) {
+                    Instruction * backedge = B->CreateBr(condBB);
+                    loopHints = hints;
+                    emitLoopHints(backedge);
+                }
                 
                 insertBB(merge);
                 setInsertBlock(merge);
@@ -1920,6 +3205,8 @@ if(baseT->isIntegerTy()) { \
                 stmt->obj("condition",&cond);
                 stmt->obj("body",&body);
                 
+                LoopHints hints = loopHints;
+                memset(&loopHints,0,sizeof(LoopHints));
                 BasicBlock * loopBody = createAndInsertBB("repeatbody");
                 BasicBlock * merge = createBB("merge");
                 
@@ -1930,7 +3217,9 @@ if(baseT->isIntegerTy()) { \
                 emitStmt(&body);
                 if(BB) {
                     Value * c = emitCond(&cond);
-                    B->CreateCondBr(c, merge, loopBody);
+                    Instruction * backedge = B->CreateCondBr(c, merge, loopBody);
+                    loopHints = hints;
+                    emitLoopHints(backedge);
                 }
                 insertBB(merge);
                 setInsertBlock(merge);
@@ -1977,6 +3266,15 @@ if(baseT->isIntegerTy()) { \
                     }
                 }
             } break;
+            case T_scatter: {
+                emitScatter(stmt);
+            } break;
+            case T_loophint: {
+                recordLoopHint(stmt);
+            } break;
+            case T_prefetch: {
+                emitPrefetch(stmt);
+            } break;
             default: {
                 emitExp(stmt);
             } break;
@@ -1984,9 +3282,39 @@ if(baseT->isIntegerTy()) { \
     }
 };
 
+static Constant * GetConstantExpressionValue(CCallingConv * CC, Obj * v) {
+    Obj exp;
+    v->obj("expression",&exp);
+    IRBuilder<> builder(*CC->C->ctx);
+    TerraCompiler c;
+    c.initConstantExpression(CC->T,&builder);
+    Constant * r = c.emitConstantExp(&exp);
+    c.finishConstantExpression();
+    return r;
+}
+//like other constants, aggregates are referred to by the address of a single read-only global
+static Constant * GetConstantExpression(CCallingConv * CC, Obj * v) {
+    Constant * r = (Constant*) v->ud("llvm_value");
+    if(r == NULL) {
+        r = GetConstantExpressionValue(CC,v);
+        if(r->getType()->isAggregateType()) {
+            Obj t;
+            v->obj("type",&t);
+            GlobalVariable * gv = new GlobalVariable(*CC->C->m, r->getType(), true, GlobalValue::PrivateLinkage, r, "const");
+            gv->setAlignment(std::max(CC->C->td->getPrefTypeAlignment(r->getType()),CC->GetRequestedAlignment(&t)));
+            gv->setUnnamedAddr(true);
+            r = gv;
+        }
+        lua_pushlightuserdata(CC->L,r);
+        v->setfield("llvm_value");
+    }
+    return r;
+}
+
 static int terra_codegen(lua_State * L) { //entry point into compiler from lua code
     terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
     assert(T->L == L);
+    terra_compilerstateinit(T);
     
     //create lua table to hold object references anchored on stack
     int ref_table = lobj_newreftable(T->L);
@@ -2005,6 +3333,7 @@ static int terra_codegen(lua_State * L) { //entry point into compiler from lua c
 static int terra_createglobal(lua_State * L) { //entry point into compiler from lua code
     terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
     assert(T->L == L);
+    terra_compilerstateinit(T);
     
     //create lua table to hold object references anchored on stack
     int ref_table = lobj_newreftable(T->L);
@@ -2026,6 +3355,7 @@ static int terra_createglobal(lua_State * L) { //entry point into compiler from
 static int terra_optimize(lua_State * L) {
     terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
     assert(T->L == L);
+    terra_compilerstateinit(T);
     
     int ref_table = lobj_newreftable(T->L);
     
@@ -2045,7 +3375,7 @@ static int terra_optimize(lua_State * L) {
         for(int i = 0; i < N; i++) {
             Obj funcobj;
             funclist.objAt(i,&funcobj);
-            Function * func = (Function*) funcobj.ud("llvm_function");
+            Function * func = GetBodyFunction(&funcobj);
             assert(func);
             scc.push_back(func);
             DEBUG_ONLY(T) {
@@ -2062,7 +3392,7 @@ static int terra_optimize(lua_State * L) {
         for(int i = 0; i < N; i++) {
             Obj funcobj;
             funclist.objAt(i,&funcobj);
-            Function * func = (Function*) funcobj.ud("llvm_function");
+            Function * func = GetBodyFunction(&funcobj);
             assert(func);
             
             DEBUG_ONLY(T) {
@@ -2084,9 +3414,23 @@ static int terra_optimize(lua_State * L) {
     return 0;
 }
 
+//the limit is checked before each function is JITed, so the function that crosses it still gets its code
+static void CheckJITMemoryLimit(terra_State * T) {
+    if(T->C->jitmemorylimit == 0)
+        return;
+    terra_JITMemoryStats stats;
+    T->C->jitmemory->GetStats(&stats);
+    if(stats.live >= T->C->jitmemorylimit) {
+        terra_reporterror(T,"JIT code memory limit reached: %lu bytes of code are live and the limit is %lu bytes\n",
+                          (unsigned long) stats.live, (unsigned long) T->C->jitmemorylimit);
+    }
+}
+
 static int terra_jit(lua_State * L) {
     terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
     assert(T->L == L);
+    terra_compilerstateinit(T);
+    CheckJITMemoryLimit(T);
     
     int ref_table = lobj_newreftable(T->L);
     
@@ -2096,7 +3440,9 @@ static int terra_jit(lua_State * L) {
         jitobj.initFromStack(L, ref_table);
         jitobj.obj("func", &funcobj);
         jitobj.obj("flags",&flags);
-        Function * func = (Function*) funcobj.ud("llvm_function");
+        CCallingConv CC;
+        CC.init(T, T->C, NULL);
+        Function * func = GetCFunction(&CC,&funcobj);
         assert(func);
         ExecutionEngine * ee = T->C->ee;
         
@@ -2108,7 +3454,7 @@ static int terra_jit(lua_State * L) {
             LLVMLinkInJIT();
             LLVMLinkInMCJIT();
             std::vector<std::string> attr;
-            attr.push_back("+avx");
+            attr.push_back(TERRA_TARGET_FEATURES);
             std::string err;
             ee = EngineBuilder(T->C->m)
                  .setUseMCJIT(true)
@@ -2136,13 +3482,197 @@ static int terra_jit(lua_State * L) {
     return 0;
 }
 
-static int terra_deletefunction(lua_State * L) {
+//lua C-API stubs: instead of calling a function through the ffi wrapper (which boxes multiple returns
+//into a cdata struct), we generate an 'int stub(lua_State*)' that reads the arguments straight off of the
+//lua stack, calls the function, and pushes each result. The stub only understands numbers, booleans, 
+//lightuserdata, and nil. If it sees anything else (e.g. a cdata argument) it returns -1 before touching the stack
+//and the trampoline falls back to the ffi wrapper.
+typedef int (*LuaStub)(lua_State * L);
+
+static int terra_luastubtrampoline(lua_State * L) {
+    LuaStub stub = (LuaStub) lua_touserdata(L,lua_upvalueindex(1));
+    int nparams = lua_tointeger(L,lua_upvalueindex(2));
+    int nargs = lua_gettop(L);
+    if(nargs == nparams) {
+        int nresults = stub(L);
+        if(nresults >= 0)
+            return nresults;
+    }
+    lua_pushvalue(L,lua_upvalueindex(3)); //the ffi fallback
+    lua_insert(L,1);
+    lua_call(L,nargs,LUA_MULTRET);
+    return lua_gettop(L);
+}
+
+struct LuaStubCompiler {
+    terra_State * T;
+    terra_CompilerState * C;
+    IRBuilder<> * B;
+    CCallingConv CC;
+    Value * state; //the lua_State * argument of the stub
+    Type * int32Ty;
+    Type * doubleTy;
+    
+    Value * LuaAPI(const char * name, void * addr, Type * rt, Type * arg) {
+        return GetLuaAPIFunction(C, name, addr, rt, arg);
+    }
+    Value * Int32(int v) {
+        return ConstantInt::get(int32Ty, v);
+    }
+    Value * emitCheck(TType * t, int idx) {
+        Value * luatype = LuaAPI("lua_type", (void*) &lua_type, int32Ty, int32Ty);
+        Value * ty = B->CreateCall2(luatype, state, Int32(idx));
+        if(t->type->isPointerTy()) {
+            return B->CreateOr(B->CreateICmpEQ(ty, Int32(LUA_TLIGHTUSERDATA)),
+                               B->CreateICmpEQ(ty, Int32(LUA_TNIL)));
+        } else if(t->islogical) {
+            return B->CreateICmpEQ(ty, Int32(LUA_TBOOLEAN));
+        } else {
+            return B->CreateICmpEQ(ty, Int32(LUA_TNUMBER));
+        }
+    }
+    Value * emitArgument(TType * t, int idx) {
+        if(t->type->isPointerTy()) {
+            Value * touserdata = LuaAPI("lua_touserdata", (void*) &lua_touserdata, Type::getInt8PtrTy(*C->ctx), int32Ty);
+            return B->CreateBitCast(B->CreateCall2(touserdata, state, Int32(idx)), t->type);
+        } else if(t->islogical) {
+            Value * toboolean = LuaAPI("lua_toboolean", (void*) &lua_toboolean, int32Ty, int32Ty);
+            Value * b = B->CreateCall2(toboolean, state, Int32(idx));
+            return B->CreateZExt(B->CreateICmpNE(b, Int32(0)), t->type);
+        }
+        Value * tonumber = LuaAPI("lua_tonumber", (void*) &lua_tonumber, doubleTy, int32Ty);
+        Value * n = B->CreateCall2(tonumber, state, Int32(idx));
+        if(t->type->isIntegerTy()) {
+            return (t->issigned) ? B->CreateFPToSI(n, t->type) : B->CreateFPToUI(n, t->type);
+        } else if(t->type->isFloatTy()) {
+            return B->CreateFPTrunc(n, t->type);
+        }
+        return n;
+    }
+    void emitPush(TType * t, Value * v) {
+        if(t->islogical) {
+            Value * pushboolean = LuaAPI("lua_pushboolean", (void*) &lua_pushboolean, Type::getVoidTy(*C->ctx), int32Ty);
+            B->CreateCall2(pushboolean, state, B->CreateZExt(B->CreateICmpNE(v, ConstantInt::get(t->type, 0)), int32Ty));
+            return;
+        }
+        if(t->type->isIntegerTy()) {
+            v = (t->issigned) ? B->CreateSIToFP(v, doubleTy) : B->CreateUIToFP(v, doubleTy);
+        } else if(t->type->isFloatTy()) {
+            v = B->CreateFPExt(v, doubleTy);
+        }
+        Value * pushnumber = LuaAPI("lua_pushnumber", (void*) &lua_pushnumber, Type::getVoidTy(*C->ctx), doubleTy);
+        B->CreateCall2(pushnumber, state, v);
+    }
+    void * run(terra_State * _T, Obj * funcobj, int * nparams) {
+        T = _T;
+        C = T->C;
+        B = new IRBuilder<>(*C->ctx);
+        CC.init(T, C, B);
+        int32Ty = Type::getInt32Ty(*C->ctx);
+        doubleTy = Type::getDoubleTy(*C->ctx);
+        
+        Function * fn = GetBodyFunction(funcobj);
+        assert(fn);
+        bool fast = UsesFastConvention(funcobj);
+        Obj ftype, params, returns;
+        funcobj->obj("type",&ftype);
+        ftype.obj("parameters",&params);
+        ftype.obj("returns",&returns);
+        
+        std::vector<Type *> stubargs;
+        stubargs.push_back(Type::getInt8PtrTy(*C->ctx));
+        FunctionType * stubtype = FunctionType::get(int32Ty, stubargs, false);
+        Function * stub = Function::Create(stubtype, Function::InternalLinkage, fn->getName() + "_luastub", C->m);
+        state = stub->arg_begin();
+        
+        BasicBlock * entry = BasicBlock::Create(*C->ctx, "entry", stub);
+        BasicBlock * fallback = BasicBlock::Create(*C->ctx, "fallback", stub);
+        B->SetInsertPoint(fallback);
+        B->CreateRet(Int32(-1));
+        B->SetInsertPoint(entry);
+        
+        //check all the arguments before converting any of them, so the fallback sees an untouched stack
+        int N = params.size();
+        std::vector<TType *> paramtypes;
+        for(int i = 0; i < N; i++) {
+            Obj p;
+            params.objAt(i,&p);
+            paramtypes.push_back(CC.GetType(&p));
+            BasicBlock * next = BasicBlock::Create(*C->ctx, "checked", stub);
+            B->CreateCondBr(emitCheck(paramtypes[i], i + 1), next, fallback);
+            B->SetInsertPoint(next);
+        }
+        std::vector<Value *> actuals;
+        for(int i = 0; i < N; i++) {
+            actuals.push_back(emitArgument(paramtypes[i], i + 1));
+        }
+        
+        Value * result = (fast) ? CC.EmitFastCall(&ftype, fn, &actuals) : CC.EmitCall(&ftype, &params, fn, &actuals);
+        
+        int NR = returns.size();
+        for(int i = 0; i < NR; i++) {
+            Obj r;
+            returns.objAt(i,&r);
+            emitPush(CC.GetType(&r), CC.EmitExtractReturn(result, NR, i));
+        }
+        B->CreateRet(Int32(NR));
+        
+        DEBUG_ONLY(T) {
+            stub->dump();
+        }
+        verifyFunction(*stub);
+        C->fpm->run(*stub);
+        
+        AttachFunctionGCHandle(T,funcobj,"llvm_stubgchandle",stub);
+        delete B;
+        
+        *nparams = N;
+        return C->ee->getPointerToFunction(stub);
+    }
+};
+
+static int terra_createluastub(lua_State * L) {
     terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
     assert(T->L == L);
-    Function ** fp = (Function**) lua_touserdata(L,-1);
-    assert(fp);
-    Function * func = (Function*) *fp;
-    assert(func);
+    terra_compilerstateinit(T);
+    //arguments: the (compiled) function definition, and the lua function to call when the stub cannot handle the arguments
+    int ref_table = lobj_newreftable(T->L);
+    
+    void * ptr;
+    int nparams;
+    {
+        Obj funcobj;
+        lua_pushvalue(L,1);
+        funcobj.initFromStack(L, ref_table);
+        LuaStubCompiler c;
+        ptr = c.run(T,&funcobj,&nparams);
+    } //scope to ensure that all Obj held in the compiler are destroyed before we pop the reference table off the stack
+    
+    lobj_removereftable(T->L,ref_table);
+    
+    lua_pushlightuserdata(L,ptr);
+    lua_pushinteger(L,nparams);
+    lua_pushvalue(L,2);
+    lua_pushcclosure(L,terra_luastubtrampoline,3);
+    return 1;
+}
+
+Function * terra_cfunction(struct terra_State * T, int funcidx) {
+    int ref_table = lobj_newreftable(T->L);
+    Function * fn;
+    {
+        Obj funcobj;
+        lua_pushvalue(T->L,funcidx);
+        funcobj.initFromStack(T->L, ref_table);
+        CCallingConv CC;
+        CC.init(T, T->C, NULL);
+        fn = GetCFunction(&CC,&funcobj);
+    }
+    lobj_removereftable(T->L,ref_table);
+    return fn;
+}
+
+static void DeleteFunction(terra_State * T, Function * func) {
     DEBUG_ONLY(T) {
         printf("deleting function: %s\n",func->getName().str().c_str());
     }
@@ -2151,25 +3681,64 @@ static int terra_deletefunction(lua_State * L) {
             printf("... and deleting generated code\n");
         }
         T->C->ee->freeMachineCodeForFunction(func); 
+        terra_profilerremovefunction(func);
     }
     func->eraseFromParent();
     DEBUG_ONLY(T) {
         printf("... finish delete.\n");
     }
-    *fp = NULL;
+}
+static void ReleaseCallbackStub(terra_State * T, CallbackStub * stub) {
+    if(--stub->refs > 0)
+        return;
+    luaL_unref(T->L,LUA_REGISTRYINDEX,stub->luaref);
+    DeleteFunction(T,stub->fn);
+    delete stub;
+}
+static int terra_deletefunction(lua_State * L) {
+    terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
+    assert(T->L == L);
+    FunctionGCHandle * h = (FunctionGCHandle*) lua_touserdata(L,-1);
+    assert(h);
+    if(!T->C) //the compiler state was already deleted when the lua state was closed
+        return 0;
+    if(h->stub) { //a native callback object, the stub is deleted along with its last caller
+        ReleaseCallbackStub(T,h->stub);
+        h->stub = NULL;
+        h->fn = NULL;
+        return 0;
+    }
+    assert(h->fn);
+    if(h->thunk) //the thunk calls fn, so it goes first
+        DeleteFunction(T,h->thunk);
+    DeleteFunction(T,h->fn);
+    h->fn = h->thunk = NULL;
+    if(h->callbacks) { //fn no longer calls these stubs
+        for(size_t i = 0; i < h->callbacks->size(); i++)
+            ReleaseCallbackStub(T,(*h->callbacks)[i]);
+        delete h->callbacks;
+        h->callbacks = NULL;
+    }
     return 0;
 }
 static int terra_disassemble(lua_State * L) {
     terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
     assert(T->L == L);
-    lua_getfield(L, -1, "fptr");
-    void * data = lua_touserdata(L, -1);
-    lua_getfield(L,-2,"llvm_function");
-    Function * fn = (Function*) lua_touserdata(L, -1);
-    assert(fn);
-    fn->dump();
-    size_t sz = T->C->functionsizes[fn];
-    llvmutil_disassemblefunction(data, sz);
+    terra_compilerstateinit(T);
+    //the body of the function, followed by its C-ABI thunk if it has one
+    const char * fields[] = { "llvm_fastfunction", "llvm_function" };
+    int funcobj = lua_gettop(L);
+    for(int i = 0; i < 2; i++) {
+        lua_getfield(L, funcobj, fields[i]);
+        Function * fn = (Function*) lua_touserdata(L, -1);
+        lua_pop(L,1);
+        if(!fn)
+            continue;
+        fn->dump();
+        void * data = T->C->ee->getPointerToGlobalIfAvailable(fn);
+        if(data)
+            llvmutil_disassemblefunction(data, T->C->functionsizes[fn]);
+    }
     return 0;
 }
 
@@ -2179,6 +3748,7 @@ static int terra_saveobjimpl(lua_State * L) {
     bool isexe = luaL_checkint(L, -2);
     terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
     assert(T->L == L);
+    terra_compilerstateinit(T);
     int ref_table = lobj_newreftable(T->L);
     
 
@@ -2204,18 +3774,28 @@ static int terra_saveobjimpl(lua_State * L) {
     
         std::vector<Function *> livefns;
         std::vector<std::string> names;
+        CCallingConv CC;
+        CC.init(T, T->C, NULL);
         //iterate over the key value pairs in the table
         lua_pushnil(L);
         while (lua_next(L, tbl) != 0) {
             const char * key = luaL_checkstring(L, -2);
             Obj obj;
             obj.initFromStack(L, ref_table);
-            Function * fnold = (Function*) obj.ud("llvm_function");
+            Function * fnold = GetCFunction(&CC,&obj);
             assert(fnold);
             names.push_back(key);
             livefns.push_back(fnold);
         }
         
+        //debug info generated so far is completed before it is copied into the object file,
+        //functions compiled afterwards go into a new compile unit
+        if(T->C->dibuilder) {
+            T->C->dibuilder->finalize();
+            delete T->C->dibuilder;
+            T->C->dibuilder = NULL;
+        }
+        
         Module * M = llvmutil_extractmodule(T->C->m, T->C->tm, &livefns, &names);
         
         DEBUG_ONLY(T) {
@@ -2281,6 +3861,36 @@ static int terra_pointertolightuserdata(lua_State * L) {
     lua_pushlightuserdata(L, *cdata);
     return 1;
 }
+
+static int terra_jitmemory(lua_State * L) {
+    terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
+    assert(T->L == L);
+    terra_JITMemoryStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if(T->C->initialized)
+        T->C->jitmemory->GetStats(&stats);
+    lua_newtable(L);
+    #define SET_STAT(nm) lua_pushnumber(L, stats.nm); lua_setfield(L,-2,#nm);
+    SET_STAT(live)
+    SET_STAT(free)
+    SET_STAT(largestfree)
+    SET_STAT(reserved)
+    SET_STAT(slabs)
+    SET_STAT(functions)
+    #undef SET_STAT
+    lua_pushnumber(L, T->C->jitmemorylimit);
+    lua_setfield(L,-2,"limit");
+    return 1;
+}
+
+static int terra_setjitmemorylimit(lua_State * L) {
+    terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
+    assert(T->L == L);
+    double limit = luaL_optnumber(L,1,0);
+    T->C->jitmemorylimit = (limit > 0) ? (size_t) limit : 0;
+    return 0;
+}
+
 static int terra_isintegral(lua_State * L) {
     double v = luaL_checknumber(L,-1);
     bool integral = std::isfinite(v) && (double)(int)v == v; 
@@ -2304,6 +3914,7 @@ static int terra_linklibraryimpl(lua_State * L) {
 static int terra_dumpmodule(lua_State * L) {
     terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
     assert(T->L == L);
+    terra_compilerstateinit(T);
     T->C->m->dump();
     return 0;
 }
@@ -2,6 +2,15 @@
 #define _tcompiler_h
 
 struct terra_State;
+namespace llvm {
+    class Function;
+}
 int terra_compilerinit(struct terra_State * T);
+//creates the LLVM context, module and JIT for T if they do not exist yet, raising a lua error if that fails
+//every entry point that uses T->C (other than to check this) must call it first
+void terra_compilerstateinit(struct terra_State * T);
+//the C-ABI entry point for the compiled function definition at stack index funcidx (an absolute index)
+//terra functions call each other with an internal convention, so this creates a thunk the first time it is needed
+llvm::Function * terra_cfunction(struct terra_State * T, int funcidx);
 
 #endif
\ No newline at end of file
@@ -1,19 +1,28 @@
 #ifndef _tcompilerstate_h
 #define _tcompilerstate_h
 
+#include <pthread.h>
 #include "llvmheaders.h"
 #include "tinline.h"
+#include "tjitmemory.h"
 
 struct terra_CompilerState {
+    pthread_t luathread; //the thread that created the lua state, native callbacks only call into lua from it
+    bool initialized; //the fields below are created by terra_compilerstateinit on first use
+    bool guaranteedtailcalls; //terra.usetailcalls when the state was initialized
     llvm::Module * m;
     llvm::LLVMContext * ctx;
     llvm::ExecutionEngine * ee;
+    TerraJITMemoryManager * jitmemory; //owned by ee
+    size_t jitmemorylimit; //set before initialization is allowed, 0 means no limit
     llvm::JITEventListener * jiteventlistener;
     llvm::FunctionPassManager * fpm;
     llvm::TargetMachine * tm;
     const llvm :: TARGETDATA() * td;
     llvm::ManualInliner * mi;
     llvm::DenseMap<const llvm::Function *, size_t> functionsizes;
+    llvm::DIBuilder * dibuilder; //created when the first function with debug info is compiled
+    char * dibuilderdirectory;
     size_t next_unused_id; //for creating names for dummy functions
 };
 
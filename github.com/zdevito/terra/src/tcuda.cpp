@@ -16,6 +16,7 @@ extern "C" {
 #include "llvmheaders.h"
 #include "terrastate.h"
 #include "tcompilerstate.h"
+#include "tcompiler.h"
 #include "tllvmutil.h"
 #include "cudalib.h"
 
@@ -87,6 +88,7 @@ CUresult moduleToPTX(terra_State * T, llvm::Module * M, std::string * buf) {
 int terra_cudacompile(lua_State * L) {
     terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
     assert(T->L == L);
+    terra_compilerstateinit(T);
     initializeCUDAState(T);
 
     int tbl = lua_gettop(L);
@@ -95,11 +97,10 @@ int terra_cudacompile(lua_State * L) {
     
     lua_pushnil(L);
     while (lua_next(L, tbl) != 0) {
-        lua_getfield(L,-1,"llvm_function");
-        llvm::Function * fn = (llvm::Function*) lua_topointer(L,-1);
+        llvm::Function * fn = terra_cfunction(T,lua_gettop(L));
         assert(fn);
         fns.push_back(fn);
-        lua_pop(L,2);  /* variant, function pointer */
+        lua_pop(L,1);  /* variant */
     }
     
     llvm::Module * M = llvmutil_extractmodule(T->C->m, T->C->tm, &fns,NULL);
@@ -19,6 +19,7 @@ extern "C" {
 
 #include "llvmheaders.h"
 #include "tcompilerstate.h"
+#include "tcompiler.h"
 #include "clangpaths.h"
 
 using namespace clang;
@@ -522,7 +523,7 @@ static int dofile(terra_State * T, const char * code, const char ** argbegin, co
     llvm::MemoryBuffer * membuffer = llvm::MemoryBuffer::getMemBufferCopy(buffer, "<buffer>");
     initializeclang(T, membuffer, argbegin, argend, &TheCompInst);
                                            
-    CodeGenerator * codegen = CreateLLVMCodeGen(TheCompInst.getDiagnostics(), "mymodule", TheCompInst.getCodeGenOpts(), llvm::getGlobalContext() );
+    CodeGenerator * codegen = CreateLLVMCodeGen(TheCompInst.getDiagnostics(), "mymodule", TheCompInst.getCodeGenOpts(), *T->C->ctx );
 
     ParseAST(TheCompInst.getPreprocessor(),
             codegen,
@@ -566,6 +567,7 @@ static int dofile(terra_State * T, const char * code, const char ** argbegin, co
 int include_c(lua_State * L) {
     terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
     assert(T->L == L);
+    terra_compilerstateinit(T);
     const char * code = luaL_checkstring(L, -2);
     int N = lua_objlen(L, -1);
     std::vector<const char *> args;
@@ -602,6 +604,7 @@ int include_c(lua_State * L) {
 int register_c_function(lua_State * L) {
     terra_State * T = (terra_State*) lua_topointer(L,lua_upvalueindex(1));
     assert(T->L == L);
+    terra_compilerstateinit(T);
     
     int ref_table = lobj_newreftable(L);
     {
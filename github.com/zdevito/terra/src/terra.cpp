@@ -10,6 +10,8 @@
 #include "tkind.h"
 #include "tcwrapper.h"
 #include "tcuda.h"
+#include "tparallel.h"
+#include "tprofiler.h"
 
 #include <stdio.h>
 #include <stdarg.h>
@@ -197,10 +199,37 @@ int terra_lualoadstring(lua_State * L) {
 //defines strict.lua bytecodes
 #include "strict.h"
 
+//standard libraries that ship with terra, these are not run at startup
+//terralib.require(name) runs them the first time they are needed
+#include "soalib.h"
+#include "parallellib.h"
+#include "alloclib.h"
+#include "fusionlib.h"
+
+#define TERRA_BUILTIN_PACKAGES(_) \
+    _("std.soa",soalib) \
+    _("std.parallel",parallellib) \
+    _("std.alloc",alloclib) \
+    _("std.fusion",fusionlib)
+
 int terra_loadandrunbytecodes(lua_State * L, const char * bytecodes, size_t size, const char * name) {
     return luaL_loadbuffer(L, bytecodes, size, name) 
            || lua_pcall(L,0,LUA_MULTRET,0);
 }
+
+static int registerbuiltinpackages(lua_State * L) {
+    lua_getfield(L,LUA_GLOBALSINDEX,"terra");
+    lua_newtable(L);
+    #define REGISTER_PACKAGE(name,lib) \
+    if(int err = luaL_loadbuffer(L, luaJIT_BC_##lib, luaJIT_BC_##lib##_SIZE, #lib ".lua")) \
+        return err; \
+    lua_setfield(L,-2,name);
+    TERRA_BUILTIN_PACKAGES(REGISTER_PACKAGE)
+    #undef REGISTER_PACKAGE
+    lua_setfield(L,-2,"builtinpackages");
+    lua_pop(L,1);
+    return 0;
+}
 int terra_init(lua_State * L) {
     terra_State * T = (terra_State*) malloc(sizeof(terra_State));
     assert(T);
@@ -225,6 +254,12 @@ int terra_init(lua_State * L) {
         return err;
     }
     
+    err = registerbuiltinpackages(T->L);
+    if(err) {
+        free(T);
+        return err;
+    }
+    
     terra_cwrapperinit(T);
     
     lua_getfield(T->L,LUA_GLOBALSINDEX,"terra");
@@ -260,6 +295,18 @@ int terra_init(lua_State * L) {
         return err;
     }
 
+    err = terra_parallelinit(T);
+    if(err) {
+        free(T);
+        return err;
+    }
+
+    err = terra_profilerinit(T);
+    if(err) {
+        free(T);
+        return err;
+    }
+
     return 0;   
 }
 
@@ -31,6 +31,7 @@ debug.sethook(debughook,"l")
 local ffi = require("ffi")
 
 terra.isverbose = 0 --set by C api
+terra.debuginfo = false --when true, functions are compiled with DWARF line tables and variable locations (terra -g)
 
 local function dbprint(level,...) 
     if terra.isverbose >= level then
@@ -251,6 +252,7 @@ function terra.context:finish(anchor)
         else
             for i,o in ipairs(scc) do
                 terra.codegen(o)
+                terra.profilerdefinitions[o.llvm_fastfunction or o.llvm_function] = o
                 o.state = "emittedllvm"
             end
             terra.optimize({ functions = functions, flags = self.compileflags })
@@ -468,6 +470,7 @@ end
 function terra.funcdefinition:jit()
     if self.state == "emittedllvm" then
         terra.jit({ func = self, flags = {} })
+        terra.profilerdefinitions[self.llvm_function] = self --the C-ABI thunk, created by terra.jit
         self.state = "compiled"
     end
 end
@@ -531,7 +534,7 @@ function terra.funcdefinition:emitllvm(cont)
     end
 end
 
-function terra.funcdefinition:__call(...)
+local function callwithffi(self,...)
     local ffiwrapper = self:getpointer()
     local NR = #self.type.returns
     if NR <= 1 then --fast path
@@ -546,6 +549,16 @@ function terra.funcdefinition:__call(...)
         return unpack(rl)
     end
 end
+
+function terra.funcdefinition:__call(...)
+    if terra.useluastubs then
+        local stub = self:getluastub()
+        if stub then
+            return stub(...)
+        end
+    end
+    return callwithffi(self,...)
+end
 function terra.funcdefinition:getpointer()
     self:compile()
     if not self.ffiwrapper then
@@ -554,6 +567,44 @@ function terra.funcdefinition:getpointer()
     return self.ffiwrapper
 end
 
+--when true, calls from lua go through a lua C-API stub (terra.createluastub) rather than the ffi wrapper
+terra.useluastubs = false
+
+--when true, the compiler state is created with guaranteed tail calls (see terra_compilerstateinit), which 'return tailcall' requires
+terra.usetailcalls = false
+
+--stubs are only generated when they can convert the values exactly like the ffi does,
+--the ffi returns structs, pointers and 64-bit integers as cdata objects, which cannot be created through the lua C API,
+--so functions that return them (including multi-word struct returns) keep using the ffi wrapper
+local function stubbableparameter(t)
+    return t:isprimitive() or (t:ispointer() and not t:ispointertofunction())
+end
+local function stubbablereturn(t)
+    return t:isfloat() or t:islogical() or (t:isintegral() and t.bytes <= 4)
+end
+
+function terra.funcdefinition:getluastub()
+    self:compile()
+    if self.luastub == nil then
+        local typ = self.type
+        local stubbable = not typ.isvararg
+        for i,p in ipairs(typ.parameters) do
+            stubbable = stubbable and stubbableparameter(p)
+        end
+        for i,r in ipairs(typ.returns) do
+            stubbable = stubbable and stubbablereturn(r)
+        end
+        if stubbable then
+            --arguments the stub does not understand (cdata, strings) are passed to the ffi wrapper instead
+            local fallback = function(...) return callwithffi(self,...) end
+            self.luastub = terra.createluastub(self,fallback)
+        else
+            self.luastub = false
+        end
+    end
+    return self.luastub or nil
+end
+
 terra.llvm_gcdebugmetatable = { __gc = function(obj)
     print("GC IS CALLED")
 end }
@@ -591,7 +642,10 @@ function terra.func:__call(...)
         local defn = self.definitions[1]
         local ptr = defn:getpointer() --forces compilation
         local NR = #defn.type.returns
-        if NR <= 1 then
+        local stub = terra.useluastubs and defn:getluastub()
+        if stub then
+            self.fastcall = stub
+        elseif NR <= 1 then
             self.fastcall = ptr
         else
             self.fastcall = defn
@@ -660,7 +714,7 @@ function terra.globalvar:gettype()
 end
 
 --terra.createglobal provided by tcompiler.cpp
-function terra.global(a0, a1)
+function terra.global(a0, a1, alignment)
     local typ,c
     if terra.types.istype(a0) then
         typ = a0
@@ -671,8 +725,11 @@ function terra.global(a0, a1)
         c = terra.constant(a0)
         typ = c.type
     end
+    if alignment ~= nil and (type(alignment) ~= "number" or alignment < 1 or alignment ~= math.floor(alignment)) then
+        error("expected a positive integer alignment but found "..tostring(alignment),2)
+    end
     
-    local gbl =  setmetatable({type = typ, isglobal = true, initializer = c},terra.globalvar)
+    local gbl =  setmetatable({type = typ, isglobal = true, initializer = c, alignment = alignment},terra.globalvar)
     
     if c then --if we have an initializer we know that the type is not opaque and we can create the variable
               --we need to call this now because it is possible for the initializer's underlying cdata object to change value
@@ -734,6 +791,82 @@ _G["macro"] = terra.createmacro --introduce macro intrinsic into global namespac
 
 -- END MACRO
 
+-- TEMPLATE
+-- a template wraps a lua function that generates terra code (functions, types, ...) from its arguments
+-- the results are memoized by argument, so instantiating a template twice with the same arguments
+-- returns the same objects, which keep their funcdefinitions and any code already compiled for them
+
+terra.template = {}
+terra.template.__index = terra.template
+
+function terra.istemplate(t)
+    return getmetatable(t) == terra.template
+end
+
+function terra.newtemplate(generator,name)
+    if type(generator) ~= "function" then
+        error("expected a lua function to generate the template but found "..type(generator),2)
+    end
+    return setmetatable({ generator = generator, name = name or "<anonymous>", cache = {}, hits = 0, misses = 0 },terra.template)
+end
+
+local templatenil = {}
+local templatevalue = {}
+local templatebusy = {}
+
+--numbers, strings and booleans are keyed by value, everything else (types, functions, tables) by identity
+local function templatekey(v)
+    if v == nil then
+        return templatenil
+    elseif type(v) == "number" or type(v) == "string" or type(v) == "boolean" then
+        return type(v)..":"..tostring(v)
+    end
+    return v
+end
+
+function terra.template:__call(...)
+    local node = self.cache
+    local N = select("#",...)
+    for i = 0,N do --level 0 is keyed by the number of arguments
+        local k = (i == 0 and N) or templatekey((select(i,...)))
+        local nxt = node[k]
+        if not nxt then
+            nxt = {}
+            node[k] = nxt
+        end
+        node = nxt
+    end
+    local results = node[templatevalue]
+    if results == templatebusy then
+        error("template "..self.name.." was instantiated recursively with the same arguments",2)
+    elseif results then
+        self.hits = self.hits + 1
+        return unpack(results)
+    end
+    node[templatevalue] = templatebusy
+    local success,err = pcall(function(...) results = {self.generator(...)} end,...)
+    if not success then
+        node[templatevalue] = nil
+        error(err,0)
+    end
+    node[templatevalue] = results
+    self.misses = self.misses + 1
+    return unpack(results)
+end
+
+--returns the number of instantiations that were reused and the number that were generated
+function terra.template:stats()
+    return self.hits, self.misses
+end
+
+function terra.template:printstats()
+    print("template "..self.name)
+    print("","instances",self.misses)
+    print("","reused",self.hits)
+end
+
+-- END TEMPLATE
+
 
 function terra.israwlist(l)
     if terralib.islist(l) then
@@ -799,6 +932,10 @@ function terra.quote:asvalue()
         elseif e:is "typedexpressionlist" then
             local e1 = e.expressions[1]
             return (e1 and getvalue(e1)) or {} 
+        elseif e:is "treelist" then --an escaped lua list
+            return e.values:map(getvalue)
+        elseif e:is "luaobject" then --e.g. a terra function or table passed to a macro
+            return e.value
         else
              error("the rest of :asvalue() needs to be implemented...")
         end
@@ -1191,7 +1328,7 @@ do --construct type table that holds the singleton value representing each uniqu
                 ffi.cdef("typedef "..value.." "..nm.."["..tostring(self.N).."];")
                 cstring = nm
             elseif self:isvector() then
-                local value = self.type:cstring()
+                local value = (self.type:ispointer() and "intptr_t") or self.type:cstring() --C does not allow vectors of pointers
                 local nm = uniquetypename(value,"vec")
                 ffi.cdef("typedef "..value.." "..nm.." __attribute__ ((vector_size("..tostring(self.N)..")));")
                 cstring = nm 
@@ -1254,15 +1391,19 @@ do --construct type table that holds the singleton value representing each uniqu
             if terra.issymbol(keystr) then
                 keystr = "__symbol"..tostring(keystr.id)
             end
-            str = str..v.type:cstring().." "..keystr.."; "
+            local attr = (v.alignment and " __attribute__((aligned("..v.alignment..")))") or ""
+            str = str..v.type:cstring().." "..keystr..attr.."; "
             
             if v.inunion and nextalloc ~= v.allocation then
                 str = str .. " }; "
             end
             
         end
-        str = str .. "};"
-        ffi.cdef(str)
+        str = str .. "}"
+        if layout.alignment then
+            str = str .. " __attribute__((aligned("..layout.alignment..")))"
+        end
+        ffi.cdef(str..";")
     end
 
     types.type.getentries = memoize{
@@ -1305,7 +1446,7 @@ do --construct type table that holds the singleton value representing each uniqu
     }
     types.type.getlayout = memoize {
         name = "layout"; 
-        defaultvalue = { entries = terra.newlist(), keytoindex = {}, invalid = true };
+        defaultvalue = { entries = terra.newlist(), keytoindex = {}, dependencies = terra.newlist(), invalid = true };
         erroronrecursion = "type recursively contains itself";
         getvalue = function(self,diag,anchor)
             local tree = self.anchor
@@ -1317,10 +1458,35 @@ do --construct type table that holds the singleton value representing each uniqu
             
             local layout = {
                 entries = terra.newlist(),
-                keytoindex = {}
+                keytoindex = {},
+                dependencies = terra.newlist() --distinct entry types that still need to be completed along with this struct
             }
+            local isdependency = {}
+            
+            --alignment requested with struct.alignment or with an align = N field of an entry,
+            --values of the struct are placed at the largest requested alignment (including that of nested structs)
+            local function checkalignment(a)
+                if a == nil then
+                    return nil
+                end
+                local p = 1
+                while type(a) == "number" and p < a do
+                    p = p * 2
+                end
+                if p ~= a then
+                    diag:reporterror(tree,"alignment must be a power of two but found ",tostring(a))
+                    return nil
+                end
+                return a
+            end
+            local function requestalignment(a)
+                if a and a > (layout.alignment or 0) then
+                    layout.alignment = a
+                end
+            end
+            requestalignment(checkalignment(self.alignment))
 
-            local function addentry(k,t)
+            local function addentry(k,t,alignment)
                 local function ensurelayout(t)
                     if t:isstruct() then
                         t:getlayout(anchor)
@@ -1329,7 +1495,19 @@ do --construct type table that holds the singleton value representing each uniqu
                     end
                 end
                 ensurelayout(t)
-                local entry = { type = t, key = k, hasname = true, allocation = nextallocation, inunion = uniondepth > 0 }
+                if t.incomplete and not isdependency[t] then
+                    isdependency[t] = true
+                    layout.dependencies:insert(t)
+                end
+                local entry = { type = t, key = k, hasname = true, allocation = nextallocation, inunion = uniondepth > 0, alignment = checkalignment(alignment) }
+                requestalignment(entry.alignment)
+                local elem = t
+                while elem:isarray() do
+                    elem = elem.type
+                end
+                if elem:isstruct() then
+                    requestalignment(elem:getlayout(anchor).alignment)
+                end
                 if not k then
                     entry.hasname = false
                     entry.key = "_"..tostring(nextunnamed)
@@ -1364,7 +1542,7 @@ do --construct type table that holds the singleton value representing each uniqu
                     if terra.types.istype(e) then
                         addentry(nil,e)
                     elseif type(e) == "table" and terra.types.istype(e.type) then
-                        addentry(e.field,e.type)
+                        addentry(e.field,e.type,e.align)
                     elseif terra.israwlist(e) then
                         beginunion()
                         addentrylist(e)
@@ -1408,8 +1586,8 @@ do --construct type table that holds the singleton value representing each uniqu
                     self.incomplete = nil --static initializers run only once
                                           --if one of the members of this struct recursively
                                           --calls complete on this type, then it will return before the static initializer has run
-                    for i,e in ipairs(layout.entries) do
-                        e.type:complete(anchor)
+                    for i,t in ipairs(layout.dependencies) do
+                        t:complete(anchor)
                     end
                     if type(self.metamethods.__staticinitialize) == "function" then
                         terra.invokeuserfunction(self.anchor,false,self.metamethods.__staticinitialize,self)
@@ -1480,13 +1658,28 @@ do --construct type table that holds the singleton value representing each uniqu
         end
     end
     
+    --derived types are also cached on the type they are derived from,
+    --so looking up an existing one does not have to build its unique name again
     function types.pointer(typ)
         checkistype(typ)
         if typ == types.error then return types.error end
-        
-        return registertype("&"..typ.name, function()
-            return mktyp { kind = terra.kinds.pointer, type = typ }
-        end)
+        local ptr = rawget(typ,"cachedpointer")
+        if not ptr then
+            ptr = registertype("&"..typ.name, function()
+                return mktyp { kind = terra.kinds.pointer, type = typ }
+            end)
+            typ.cachedpointer = ptr
+        end
+        return ptr
+    end
+    
+    local function getcachefor(typ,name)
+        local cache = rawget(typ,name)
+        if not cache then
+            cache = {}
+            typ[name] = cache
+        end
+        return cache
     end
     
     local function checkarraylike(typ, N_)
@@ -1501,26 +1694,35 @@ do --construct type table that holds the singleton value representing each uniqu
     function types.array(typ, N_)
         local N = checkarraylike(typ,N_)
         if typ == types.error then return types.error end
-        
-        local tname = (typ:ispointer() and "("..typ.name..")") or typ.name
-        local name = tname .. "[" .. N .. "]"
-        return registertype(name,function()
-            return mkincomplete { kind = terra.kinds.array, type = typ, N = N }
-        end)
+        local cache = getcachefor(typ,"cachedarrays")
+        local arr = cache[N]
+        if not arr then
+            local tname = (typ:ispointer() and "("..typ.name..")") or typ.name
+            local name = tname .. "[" .. N .. "]"
+            arr = registertype(name,function()
+                return mkincomplete { kind = terra.kinds.array, type = typ, N = N }
+            end)
+            cache[N] = arr
+        end
+        return arr
     end
     
     function types.vector(typ,N_)
         local N = checkarraylike(typ,N_)
         if typ == types.error then return types.error end
-        
-        
-        if not typ:isprimitive() then
-            error("vectors must be composed of primitive types (for now...) but found type "..tostring(typ))
+        local cache = getcachefor(typ,"cachedvectors")
+        local vec = cache[N]
+        if not vec then
+            if not typ:isprimitive() and not typ:ispointer() then
+                error("vectors must be composed of primitive or pointer types (for now...) but found type "..tostring(typ))
+            end
+            local name = "vector("..typ.name..","..N..")"
+            vec = registertype(name,function()
+                return mktyp { kind = terra.kinds.vector, type = typ, N = N }
+            end)
+            cache[N] = vec
         end
-        local name = "vector("..typ.name..","..N..")"
-        return registertype(name,function()
-            return mktyp { kind = terra.kinds.vector, type = typ, N = N }
-        end)
+        return vec
     end
     
     function types.primitive(name)
@@ -1579,6 +1781,10 @@ do --construct type table that holds the singleton value representing each uniqu
         return types.pointer(types.functype(parameters,returns,isvararg))
     end
     
+    --function types are cached in a trie keyed by each parameter type, then returnsmarker, then each return type
+    --the leaf node maps the vararg flag to the type
+    local functypecache = {}
+    local returnsmarker = {}
     function types.functype(parameters,returns,isvararg)
         
         if not terra.islist(parameters) then
@@ -1596,6 +1802,27 @@ do --construct type table that holds the singleton value representing each uniqu
         checkalltypes(parameters)
         checkalltypes(returns)
         
+        local node = functypecache
+        local function lookup(k)
+            local child = node[k]
+            if not child then
+                child = {}
+                node[k] = child
+            end
+            node = child
+        end
+        for i,p in ipairs(parameters) do
+            lookup(p)
+        end
+        lookup(returnsmarker)
+        for i,r in ipairs(returns) do
+            lookup(r)
+        end
+        isvararg = isvararg and true or false
+        if node[isvararg] then
+            return node[isvararg]
+        end
+        
         local function getname(t) return t.name end
         local a = terra.list.map(parameters,getname):mkstring("{",",","")
         if isvararg then
@@ -1605,7 +1832,7 @@ do --construct type table that holds the singleton value representing each uniqu
         end
         local r = terra.list.map(returns,getname):mkstring("{",",","}")
         local name = a.."->"..r
-        return registertype(name,function()
+        node[isvararg] = registertype(name,function()
             local returnobj = nil
             if #returns == 1 then
                 returnobj = returns[1]
@@ -1615,6 +1842,7 @@ do --construct type table that holds the singleton value representing each uniqu
             end
             return mkincomplete { kind = terra.kinds.functype, parameters = parameters, returns = returns, isvararg = isvararg, returnobj = returnobj }
         end)
+        return node[isvararg]
     end
     
     for name,typ in pairs(types.table) do
@@ -1639,6 +1867,7 @@ end
 -- SPECIALIZATION (removal of escape expressions, escape sugar, evaluation of type expressoins)
 
 --convert a lua value 'v' into the terra tree representing that value
+terra.__aggregateconstants = setmetatable({},{ __mode = "kv" })
 function terra.createterraexpression(diag,anchor,v)
     local function createsingle(v)
         if terra.isglobalvar(v) or terra.issymbol(v) then
@@ -1654,6 +1883,14 @@ function terra.createterraexpression(diag,anchor,v)
         elseif terra.istree(v) then
             --if this is a raw tree, we just drop it in place and hope the user knew what they were doing
             return v
+        elseif type(v) == "cdata" and terra.typeof(v) and terra.typeof(v):isaggregate() then
+            --share one constant between every use of an aggregate, so a large table is only embedded once
+            local c = terra.__aggregateconstants[v]
+            if not c then
+                c = terra.constant(v)
+                terra.__aggregateconstants[v] = c
+            end
+            return createsingle(c)
         elseif type(v) == "cdata" or type(v) == "number" or type(v) == "boolean" or type(v) == "string" then
             return createsingle(terra.constant(v))
         elseif terra.isconstant(v) then
@@ -2001,6 +2238,61 @@ function terra.invokeuserfunction(anchor, speculate, userfn,  ...)
     return unpack(results)
 end
 
+--when none of the types involved has a __cast metamethod, the overload chosen for a call depends only on the parameter types
+--of the candidates and the types of the arguments, so resolutions are cached across calls (and functions) in a trie keyed by these types.
+--this avoids speculatively trying every candidate each time the same call is seen.
+--calls involving a __cast metamethod are never cached, since __cast may depend on the expression being cast and may change at any time.
+--levels are weak-keyed so that the trie does not keep types alive
+local overloadresolutions = setmetatable({},{__mode="k"})
+local overloadseparator = {}
+local overloadresult = {}
+local function hascastmetamethod(t)
+    if not terra.types.istype(t) then --"passthrough" or "vararg"
+        return false
+    elseif t:ispointertostruct() then
+        t = t.type
+    end
+    return t:isstruct() and t.metamethods.__cast ~= nil
+end
+local function getoverloadresolution(typelists,castbehavior,allowambiguous,paramlist)
+    for i,typelist in ipairs(typelists) do
+        for j,t in ipairs(typelist) do
+            if hascastmetamethod(t) then
+                return nil
+            end
+        end
+    end
+    for i,e in ipairs(paramlist.expressions) do
+        if e.type == terra.types.error or hascastmetamethod(e.type) then
+            return nil
+        end
+    end
+    local node = overloadresolutions
+    local function lookup(k)
+        local child = node[k]
+        if not child then
+            child = setmetatable({},{__mode="k"})
+            node[k] = child
+        end
+        node = child
+    end
+    lookup(castbehavior)
+    lookup(allowambiguous and true or false)
+    lookup(paramlist.minsize)
+    lookup(#typelists)
+    for i,typelist in ipairs(typelists) do
+        for j,t in ipairs(typelist) do
+            lookup(t)
+        end
+        lookup(overloadseparator)
+    end
+    lookup(#paramlist.expressions)
+    for i,e in ipairs(paramlist.expressions) do
+        lookup(e.type)
+    end
+    return node
+end
+
 function terra.funcdefinition:typecheck()
     
     assert(self.state == "untyped")
@@ -2192,7 +2484,7 @@ function terra.funcdefinition:typecheck()
         else
             local cast_exp = createcast(exp,typ)
             if ((typ:isprimitive() and exp.type:isprimitive()) or
-                (typ:isvector() and exp.type:isvector() and typ.N == exp.type.N)) and
+                (typ:isvector() and exp.type:isvector() and typ.N == exp.type.N and typ.type:isprimitive() and exp.type.type:isprimitive())) and
                not typ:islogicalorvector() and not exp.type:islogicalorvector() then
                 return cast_exp, true
             elseif typ:ispointer() and exp.type:ispointer() and typ.type == uint8 then --implicit cast from any pointer to &uint8
@@ -2205,7 +2497,7 @@ function terra.funcdefinition:typecheck()
                 --if we have an rvalue array, it must be converted to lvalue (i.e. placed on the stack) before the cast is valid
                 cast_exp.expression = aslvalue(cast_exp.expression)
                 return cast_exp, true
-            elseif typ:isvector() and exp.type:isprimitive() then
+            elseif typ:isvector() and (exp.type:isprimitive() or (typ.type:ispointer() and exp.type:ispointer())) then
                 local primitivecast, valid = insertcast(exp,typ.type,speculative)
                 local broadcast = createcast(primitivecast,typ)
                 return broadcast, valid
@@ -2262,6 +2554,11 @@ function terra.funcdefinition:typecheck()
             return createcast(exp,typ)
         elseif (typ:isprimitive() and exp.type:isprimitive())
             or (typ:isvector() and exp.type:isvector() and typ.N == exp.type.N) then --explicit conversions from logicals to other primitives are allowed
+            local function addresslike(t) return t:ispointer() or t:isintegral() end
+            if typ:isvector() and exp.type:isvector() and (typ.type:ispointer() or exp.type.type:ispointer())
+               and not (addresslike(typ.type) and addresslike(exp.type.type)) then
+                diag:reporterror(exp,"invalid conversion from ",exp.type," to ",typ)
+            end
             return createcast(exp,typ)
         else
             return insertcast(exp,typ) --otherwise, allow any implicit casts
@@ -2393,6 +2690,20 @@ function terra.funcdefinition:typecheck()
             return e:copy { type = terra.types.pointer(l.type.type), operands = terra.newlist {ascompletepointer(l),r} }
         elseif l.type:isintegral() and pointerlike(r.type) then
             return e:copy { type = terra.types.pointer(r.type.type), operands = terra.newlist {ascompletepointer(r),l} }
+        end
+        -- vectors of pointers: each lane is offset separately, a scalar pointer or integer is broadcast to every lane
+        local function vectorofpointers(t)
+            return t:isvector() and t.type:ispointer()
+        end
+        if e.operator == terra.kinds["+"] and (r.type:ispointer() or vectorofpointers(r.type)) and l.type:isintegralorvector() then
+            l,r = r,l
+        end
+        if (l.type:ispointer() or vectorofpointers(l.type)) and r.type:isintegralorvector() and (vectorofpointers(l.type) or r.type:isvector()) then
+            local N = (l.type:isvector() and l.type.N) or r.type.N
+            local ptr = (l.type:isvector() and l.type.type) or l.type
+            ptr.type:complete(e)
+            local vptr = terra.types.vector(ptr,N)
+            return e:copy { type = vptr, operands = terra.newlist {insertcast(l,vptr),insertcast(r,terra.types.vector(int64,N))} }
         else
             return meetbinary(e,"isarithmeticorvector",l,r)
         end
@@ -2607,24 +2918,38 @@ function terra.funcdefinition:typecheck()
             shortenparamlist(#typelist)
             return 1
         else
-            --evaluate each potential list
             local valididx,validcasts
-            for i,typelist in ipairs(typelists) do
-                local results,allvalid = trylist(typelist,true)
+            local resolution = getoverloadresolution(typelists,castbehavior,allowambiguous,paramlist)
+            if resolution and resolution[overloadresult] then
+                --this call has been resolved before, only the chosen option needs its casts inserted
+                local results,allvalid = trylist(typelists[resolution[overloadresult]],speculate)
                 if allvalid then
-                    if valididx == nil then
-                        valididx = i
-                        validcasts = results
-                        if allowambiguous then
+                    valididx,validcasts = resolution[overloadresult],results
+                end
+            else
+                --evaluate each potential list
+                local ambiguous = false
+                for i,typelist in ipairs(typelists) do
+                    local results,allvalid = trylist(typelist,true)
+                    if allvalid then
+                        if valididx == nil then
+                            valididx = i
+                            validcasts = results
+                            if allowambiguous then
+                                break
+                            end
+                        else
+                            local optiona = typelists[valididx]:mkstring("(",",",")")
+                            local optionb = typelist:mkstring("(",",",")")
+                            diag:reporterror(paramlist,"call to overloaded function is ambiguous. can apply to both ", optiona, " and ", optionb)
+                            ambiguous = true
                             break
                         end
-                    else
-                        local optiona = typelists[valididx]:mkstring("(",",",")")
-                        local optionb = typelist:mkstring("(",",",")")
-                        diag:reporterror(paramlist,"call to overloaded function is ambiguous. can apply to both ", optiona, " and ", optionb)
-                        break
                     end
                 end
+                if resolution and valididx and not ambiguous then
+                    resolution[overloadresult] = valididx
+                end
             end
             
             if valididx then
@@ -2771,6 +3096,10 @@ function terra.funcdefinition:typecheck()
             tryinsertcasts(terra.newlist{varargslist},castbehavior, false, false, paramlist)
             local paramtypes = paramlist.expressions:map(function(p) return p.type end)
             local castedtype = terra.types.funcpointer(paramtypes,{})
+            local nativecb = terra.usenativecallbacks and terra.nativecallback(fn,castedtype)
+            if nativecb then
+                return terra.newtree(anchor, { kind = terra.kinds.luafunction, nativecallback = nativecb, type = castedtype })
+            end
             local cb = terra.cast(castedtype,fn)
             local fptr = terra.pointertolightuserdata(cb)
             return terra.newtree(anchor, { kind = terra.kinds.luafunction, callback = cb, fptr = fptr, type = castedtype })
@@ -2857,6 +3186,85 @@ function terra.funcdefinition:typecheck()
         return e:copy { type = rt and rt:complete(e), name = name, arguments = params, intrinsictype = intrinsictype }
     end
 
+    --gathers and scatters address each lane separately, either through a vector of pointers
+    --or (for masked loads and stores) through a pointer to a whole vector
+    local function checkvectoraccess(e)
+        local addresses = checkrvalue(e.addresses)
+        local at,vtype = addresses.type
+        if e.contiguous and at:ispointer() and at.type:isvector() then
+            vtype = at.type
+        elseif not e.contiguous and at:isvector() and at.type:ispointer() and at.type.type:isprimitive() then
+            vtype = terra.types.vector(at.type.type,at.N)
+        else
+            if at ~= terra.types.error then
+                local expected = (e.contiguous and "a pointer to a vector") or "a vector of pointers to primitive types"
+                diag:reporterror(e,"expected ",expected," but found ",at)
+            end
+            return addresses, terra.types.error
+        end
+        local mask = e.mask and insertcast(checkrvalue(e.mask),terra.types.vector(bool,vtype.N))
+        return addresses, vtype, mask
+    end
+    local function checkgather(e)
+        local addresses,vtype,mask = checkvectoraccess(e)
+        local passthru = e.passthru and insertcast(checkrvalue(e.passthru),vtype)
+        return e:copy { addresses = addresses, mask = mask, passthru = passthru, type = vtype }
+    end
+    local function checkscatter(s)
+        local addresses,vtype,mask = checkvectoraccess(s)
+        local value = insertcast(checkrvalue(s.value),vtype)
+        return s:copy { addresses = addresses, mask = mask, value = value }
+    end
+
+    local function checkshuffle(e)
+        local vectors = e.vectors:map(checkrvalue)
+        local vt = vectors[1].type
+        if vt == terra.types.error then
+            return e:copy { type = terra.types.error }
+        elseif not vt:isvector() then
+            diag:reporterror(e,"expected a vector but found ",vt)
+            return e:copy { type = terra.types.error }
+        end
+        if vectors[2] then
+            vectors[2] = insertcast(vectors[2],vt)
+        end
+        local range = #vectors * vt.N
+        for i,idx in ipairs(e.indices) do
+            if type(idx) ~= "number" or idx ~= math.floor(idx) or idx < 0 or idx >= range then
+                diag:reporterror(e,"shuffle index ",tostring(idx)," is not an integer in the range [0,",range,")")
+                return e:copy { type = terra.types.error }
+            end
+        end
+        return e:copy { vectors = vectors, type = terra.types.vector(vt.type,#e.indices) }
+    end
+
+    --orderings each atomic operation accepts (fetch-and-op operations accept all of them)
+    local atomicorderings = {
+        load = { monotonic = true, acquire = true, seq_cst = true },
+        store = { monotonic = true, release = true, seq_cst = true },
+        fence = { acquire = true, release = true, acq_rel = true, seq_cst = true }
+    }
+    local function checkatomic(e)
+        local valid = atomicorderings[e.operation]
+        if valid and not valid[e.ordering] then
+            diag:reporterror(e,"memory ordering ",e.ordering," is not valid for atomic ",e.operation)
+        end
+        if e.operation == "fence" then
+            return e:copy {}
+        end
+        local address = checkrvalue(e.address)
+        local at = address.type
+        if at == terra.types.error then
+            return e:copy { type = terra.types.error }
+        elseif not at:ispointer() or not at.type:isintegral() then
+            diag:reporterror(e,"atomic operations require a pointer to an integer but found ",at)
+            return e:copy { type = terra.types.error }
+        end
+        local operands = e.operands:map(function(o) return insertcast(checkrvalue(o),at.type) end)
+        local rt = (e.operation ~= "store" and at.type) or nil --everything but store produces the previous value in memory
+        return e:copy { address = address, operands = operands, type = rt }
+    end
+
     local function truncateexpressionlist(tel)
         assert(tel:is "typedexpressionlist")
         if #tel.expressions == 0 then
@@ -2998,8 +3406,8 @@ function terra.funcdefinition:typecheck()
                 
                 local aggtype
                 if e:is "vectorconstructor" then
-                    if not typ:isprimitive() and typ ~= terra.types.error then
-                        diag:reporterror(e,"vectors must be composed of primitive types (for now...) but found type ",type(typ))
+                    if not typ:isprimitive() and not typ:ispointer() and typ ~= terra.types.error then
+                        diag:reporterror(e,"vectors must be composed of primitive or pointer types (for now...) but found type ",type(typ))
                         return e:copy { type = terra.types.error }
                     end
                     aggtype = terra.types.vector(typ,N)
@@ -3062,6 +3470,12 @@ function terra.funcdefinition:typecheck()
                 return e:copy { expressions = entries, type = typ:complete(e) }
             elseif e:is "intrinsic" then
                 return checkintrinsic(e,true)
+            elseif e:is "gather" then
+                return checkgather(e)
+            elseif e:is "shuffle" then
+                return checkshuffle(e)
+            elseif e:is "atomic" and e.operation ~= "store" and e.operation ~= "fence" then
+                return checkatomic(e)
             else
                 diag:reporterror(e,"statement found where an expression is expected ", terra.kinds[e.kind])
                 return e:copy { type = terra.types.error }
@@ -3164,7 +3578,61 @@ function terra.funcdefinition:typecheck()
     local function leaveloop()
         loopstmts:remove()
     end
-    
+
+    --return tailcall f(...): the statement must return exactly the results of a direct call to a terra function,
+    --so that the code generator can replace the caller's frame with the callee's
+    local function checktailcall(s)
+        local tel = s.expressions
+        local fncall = tel.fncall
+        local valid = fncall ~= nil and #tel.expressions == #fncall.returntypes
+        if valid then
+            for i,e in ipairs(tel.expressions) do
+                valid = valid and e:is "extractreturn" and e.fncall == fncall and e.index == i - 1
+            end
+        end
+        if not valid then
+            diag:reporterror(s,"tailcall: expected the return statement to be a single function call")
+            return
+        end
+        local callee = fncall.value
+        if not (callee:is "literal" and terra.isfunctiondefinition(callee.value) and callee.value.untypedtree and not callee.type.type.isvararg) then
+            diag:reporterror(s,"tailcall: the called function must be a terra function that is called directly")
+        end
+        --the callee reuses the caller's frame, so it cannot be handed the address of anything stored in it
+        local function islocal(e)
+            while true do
+                if e:is "var" then
+                    return not terra.isglobalvar(e.definition)
+                elseif e:is "select" or (e:is "index" and e.value.type:isarray()) then
+                    e = e.value
+                else
+                    return false
+                end
+            end
+        end
+        local function findlocaladdress(e)
+            if (e:is "operator" and e.operator == terra.kinds["&"] and islocal(e.operands[1]))
+               or (e:is "cast" and e.expression.type:isarray() and e.type:ispointer() and islocal(e.expression)) then
+                return e
+            end
+            for k,v in pairs(e) do
+                if k ~= "definition" then
+                    local children = (terra.istree(v) and {v}) or (terra.islist(v) and v) or {}
+                    for i,c in ipairs(children) do
+                        local found = terra.istree(c) and findlocaladdress(c)
+                        if found then
+                            return found
+                        end
+                    end
+                end
+            end
+        end
+        local found = findlocaladdress(fncall.arguments)
+        if found then
+            diag:reporterror(found,"tailcall: cannot pass the address of a local variable, its storage is reused by the called function")
+        end
+    end
+
     -- checking of statements
 
     function checkstmt(s)
@@ -3175,6 +3643,9 @@ function terra.funcdefinition:typecheck()
             return s:copy {statements = r}
         elseif s:is "return" then
             local rstmt = s:copy { expressions = checkparameterlist(s,s.expressions) }
+            if s.tailcall then
+                checktailcall(rstmt)
+            end
             return_stmts:insert( rstmt )
             return rstmt
         elseif s:is "label" then
@@ -3283,6 +3754,18 @@ function terra.funcdefinition:typecheck()
             return s.values:flatmap(checkstmt)
         elseif s:is "intrinsic" then
             return checkintrinsic(s,false)
+        elseif s:is "scatter" then
+            return checkscatter(s)
+        elseif s:is "atomic" then
+            return checkatomic(s)
+        elseif s:is "loophint" then
+            return s:copy {}
+        elseif s:is "prefetch" then
+            local address = checkrvalue(s.address)
+            if not address.type:ispointer() and address.type ~= terra.types.error then
+                diag:reporterror(s,"prefetch expects a pointer but found ",address.type)
+            end
+            return s:copy { address = address }
         else
             return checkexp(s,true)
         end
@@ -3358,7 +3841,19 @@ function terra.funcdefinition:typecheck()
 
     --now cast each return expression to the expected return type
     for _,stmt in ipairs(return_stmts) do
-        insertcasts(return_types,stmt.expressions)
+        if stmt.tailcall then
+            --the callee's results are returned untouched, so there is nowhere to put a cast
+            local exps = stmt.expressions.expressions
+            local same = #exps == #return_types
+            for i,exp in ipairs(exps) do
+                same = same and exp.type == return_types[i]
+            end
+            if not same then
+                diag:reporterror(stmt,"tailcall: the called function must return the same types as the calling function")
+            end
+        else
+            insertcasts(return_types,stmt.expressions)
+        end
     end
     
     --we're done. build the typed tree for this function
@@ -3376,6 +3871,60 @@ end
 --cache for lua functions called by terra, to prevent making multiple callback functions
 terra.__wrappedluafunctions = {}
 
+--native callbacks: rather than creating an ffi callback, the compiler emits a stub that pushes the
+--arguments onto the lua stack and calls the function with lua_pcall (see emitNativeCallback in tcompiler.cpp)
+--entries are cached by (function, type) so the stub for each pair is only generated once.
+--the cache does not keep anything alive: a callback lives as long as the typed trees of the functions that call it,
+--and its stub is deleted and the lua function released once the callback and all of these functions are collected
+--(see CallbackStub in tcompiler.cpp)
+terra.usenativecallbacks = false
+terra.__nativecallbacks = setmetatable({},{ __mode = "k" })
+
+local function nativecallbackparameter(t)
+    --int64s are passed as cdata by the ffi, so they stay on the ffi path
+    return t:isfloat() or t:islogical() or (t:isintegral() and t.bytes <= 4) or t:ispointer()
+end
+
+function terra.nativecallback(fn,typ)
+    local fncache = terra.__nativecallbacks[fn]
+    if not fncache then
+        fncache = setmetatable({},{ __mode = "v" })
+        terra.__nativecallbacks[fn] = fncache
+    end
+    local cb = fncache[typ]
+    if cb == nil then
+        local params = typ.type.parameters
+        local supported = true
+        for i,p in ipairs(params) do
+            supported = supported and nativecallbackparameter(p)
+        end
+        cb = false
+        if supported then
+            --pointers arrive as lightuserdata, cast them so the function sees the same cdata pointers an ffi callback would
+            local N = #params
+            local casts = {}
+            local luafunction = fn
+            for i,p in ipairs(params) do
+                if p:ispointer() then
+                    casts[i] = p:cstring()
+                end
+            end
+            if next(casts) then
+                luafunction = function(...)
+                    local args = {...}
+                    for i,ctyp in pairs(casts) do
+                        args[i] = ffi.cast(ctyp,args[i])
+                    end
+                    return fn(unpack(args,1,N))
+                end
+            end
+            cb = { luafunction = luafunction }
+        end
+        fncache[typ] = cb
+    end
+    return cb or nil
+end
+
 -- END TYPECHECKER
 
 -- INCLUDEC
@@ -3463,6 +4012,104 @@ terra.aligned = terra.internalmacro( function(diag,tree,arg,num)
     return annotatememory(arg,{alignment = n})
 end)
 
+--gather/scatter take a vector of pointers (e.g. base + vector(i0,i1,i2,i3)) and access one address per lane
+--lanes whose mask is false are not accessed, masked-off lanes of a gather are taken from passthru
+terra.gather = terra.internalmacro(function(diag,tree,addresses,mask,passthru)
+    return terra.newtree(tree, { kind = terra.kinds.gather, addresses = addresses.tree, mask = mask and mask.tree, passthru = passthru and passthru.tree })
+end)
+terra.scatter = terra.internalmacro(function(diag,tree,addresses,value,mask)
+    return terra.newtree(tree, { kind = terra.kinds.scatter, addresses = addresses.tree, value = value.tree, mask = mask and mask.tree })
+end)
+--shuffle(a,b,i0,i1,...) builds a vector whose k-th lane is lane ik of the concatenation of a and b,
+--swizzle(a,i0,i1,...) does the same for a single vector. Indices are constants, or escaped Lua lists of constants.
+local function shuffleindices(args)
+    local indices = terra.newlist()
+    for i,a in ipairs(args) do
+        local v = a:asvalue()
+        if type(v) == "table" then
+            for j,idx in ipairs(v) do
+                indices:insert(idx)
+            end
+        else
+            indices:insert(v)
+        end
+    end
+    if #indices == 0 then
+        error("expected at least one shuffle index")
+    end
+    return indices
+end
+terra.shuffle = terra.internalmacro(function(diag,tree,a,b,...)
+    return terra.newtree(tree, { kind = terra.kinds.shuffle, vectors = terra.newlist {a.tree,b.tree}, indices = shuffleindices({...}) })
+end)
+terra.swizzle = terra.internalmacro(function(diag,tree,a,...)
+    return terra.newtree(tree, { kind = terra.kinds.shuffle, vectors = terra.newlist {a.tree}, indices = shuffleindices({...}) })
+end)
+
+--atomic operations on integers in memory, the optional last argument is the memory ordering:
+--"monotonic", "acquire", "release", "acq_rel" or "seq_cst" (the default)
+local function atomicordering(ordering)
+    local o = (ordering and ordering:asvalue()) or "seq_cst"
+    local valid = { monotonic = true, acquire = true, release = true, acq_rel = true, seq_cst = true }
+    if not valid[o] then
+        error("unknown memory ordering "..tostring(o))
+    end
+    return o
+end
+local function atomicmacro(operation,nargs)
+    return terra.internalmacro(function(diag,tree,addr,...)
+        local args = {...}
+        local operands = terra.newlist()
+        for i = 1,nargs do
+            if not args[i] then
+                error("atomic "..operation.." expects "..nargs.." argument(s) after the address")
+            end
+            operands:insert(args[i].tree)
+        end
+        return terra.newtree(tree, { kind = terra.kinds.atomic, operation = operation, address = addr.tree, operands = operands, ordering = atomicordering(args[nargs+1]) })
+    end)
+end
+for i,op in ipairs {"add","sub","and","or","xor","max","min"} do
+    terra["fetch"..op] = atomicmacro(op,1)
+end
+terra.exchange = atomicmacro("xchg",1)
+terra.cmpxchg = atomicmacro("cmpxchg",2)
+terra.atomicload = atomicmacro("load",0)
+terra.atomicstore = atomicmacro("store",1)
+terra.fence = terra.internalmacro(function(diag,tree,ordering)
+    return terra.newtree(tree, { kind = terra.kinds.atomic, operation = "fence", operands = terra.newlist(), ordering = atomicordering(ordering) })
+end)
+
+--loop hints are statements that apply to the next loop in the function, e.g.
+--    terralib.unroll(4)
+--    for i = 0,N do ... end
+local function constantargument(arg,name,lo,hi,default)
+    local v = (arg and arg:asvalue()) or default
+    if type(v) ~= "number" or v ~= math.floor(v) or v < lo or (hi and v > hi) then
+        error(name.." expects a constant integer in the range ["..lo..","..(hi or "inf").."] but found "..tostring(v))
+    end
+    return v
+end
+for i,hint in ipairs {"unroll","vectorize","interleave"} do
+    terra[hint] = terra.internalmacro(function(diag,tree,n)
+        return terra.newtree(tree, { kind = terra.kinds.loophint, hint = hint, value = constantargument(n,hint,1) })
+    end)
+end
+--prefetch(addr,[rw,locality]): rw is 0 for reads (the default) and 1 for writes,
+--locality ranges from 0 (no temporal locality) to 3 (keep in all caches, the default)
+terra.prefetch = terra.internalmacro(function(diag,tree,addr,rw,locality)
+    return terra.newtree(tree, { kind = terra.kinds.prefetch, address = addr.tree, rw = constantargument(rw,"prefetch",0,1,0),
+                                 locality = constantargument(locality,"prefetch",0,3,3) })
+end)
+
+--masked loads/stores access the consecutive elements of a &vector(T,N), e.g. the tail of an array
+terra.maskedload = terra.internalmacro(function(diag,tree,addr,mask,passthru)
+    return terra.newtree(tree, { kind = terra.kinds.gather, contiguous = true, addresses = addr.tree, mask = mask.tree, passthru = passthru and passthru.tree })
+end)
+terra.maskedstore = terra.internalmacro(function(diag,tree,addr,value,mask)
+    return terra.newtree(tree, { kind = terra.kinds.scatter, contiguous = true, addresses = addr.tree, value = value.tree, mask = mask.tree })
+end)
+
 
 -- END GLOBAL MACROS
 
@@ -3553,7 +4200,7 @@ function terra.funcdefinition:printpretty()
             emitStatList(s.statements)
             leaveblock()
         elseif s:is "return" then
-            begin("return ")
+            begin(s.tailcall and "return tailcall " or "return ")
             emitParamList(s.expressions)
             emit("\n")
         elseif s:is "label" then
@@ -3719,7 +4366,7 @@ function terra.funcdefinition:printpretty()
             emitParamList(e.expressions,keys)
             emit("}")
         elseif e:is "constant" then
-            if e.type:isprimitive() then
+            if e.type:isprimitive() and e.value.object then
                 emit(tonumber(e.value.object))
             else
                 emit("<constant:",e.type,">")
@@ -3761,6 +4408,112 @@ end
 
 -- END DEBUG
 
+-- PROFILER
+-- samples are taken by a SIGPROF timer in tprofiler.cpp, which records raw stacks of code addresses
+-- here the stacks are mapped back to function definitions and summarized into a flat profile and a call graph
+
+terra.profiler = {}
+--llvm_function -> funcdefinition, so samples in JITed code can be reported by definition
+terra.profilerdefinitions = setmetatable({},{ __mode = "v" })
+
+function terra.profiler.start(hz)
+    terra.profilerstartimpl(hz)
+end
+
+local function profilerframename(frame,names)
+    if type(frame) == "string" then
+        --the LuaJIT interpreter, its traces and the lua C API are all counted as lua code
+        if frame:match("^lj_") or frame:match("^lua_") or frame:match("^luaL_") or frame:match("^luaJIT_") then
+            return "[lua]"
+        end
+        return frame
+    end
+    local def = terra.profilerdefinitions[frame]
+    if def then
+        local tree = def.untypedtree
+        return (tree and ("%s (%s:%d)"):format(def.name,tree.filename,tree.linenumber)) or def.name
+    end
+    local name = names[frame]
+    return (name == "luacallback" and "[lua callback]") or name or "[unknown]"
+end
+
+--stops sampling and returns the profile, which has the fields:
+--  samples: number of samples recorded, dropped: samples lost because the buffer was full
+--  functions: list of { name, self, total } sorted by self, where self counts samples in the function itself
+--             and total counts samples where it is anywhere on the stack
+--  calls: list of { caller, callee, count } sorted by count, the number of samples in which caller called callee
+function terra.profiler.stop()
+    terra.profilerstopimpl()
+    local samples,names,dropped = terra.profilersamples()
+    local functions = {}
+    local calls = {}
+    local function getfunction(name)
+        local f = functions[name]
+        if not f then
+            f = { name = name, self = 0, total = 0 }
+            functions[name] = f
+        end
+        return f
+    end
+    for i,stack in ipairs(samples) do
+        --innermost first, with runs of the same name (e.g. the lua interpreter) merged
+        local frames = {}
+        for d,frame in ipairs(stack) do
+            local name = profilerframename(frame,names)
+            if name ~= frames[#frames] then
+                table.insert(frames,name)
+            end
+        end
+        getfunction(frames[1]).self = getfunction(frames[1]).self + 1
+        local seen,seencall = {},{}
+        for d,name in ipairs(frames) do
+            if not seen[name] then
+                seen[name] = true
+                getfunction(name).total = getfunction(name).total + 1
+            end
+            local caller = frames[d+1]
+            if caller then
+                local key = caller.."\0"..name
+                if not seencall[key] then
+                    seencall[key] = true
+                    calls[key] = calls[key] or { caller = caller, callee = name, count = 0 }
+                    calls[key].count = calls[key].count + 1
+                end
+            end
+        end
+    end
+    local profile = { samples = #samples, dropped = dropped, functions = terra.newlist(), calls = terra.newlist() }
+    for k,f in pairs(functions) do
+        profile.functions:insert(f)
+    end
+    for k,c in pairs(calls) do
+        profile.calls:insert(c)
+    end
+    table.sort(profile.functions,function(a,b) return a.self > b.self or (a.self == b.self and a.total > b.total) end)
+    table.sort(profile.calls,function(a,b) return a.count > b.count end)
+    return profile
+end
+
+--prints the flat profile and the call graph, limited to the n most frequent entries (default 20)
+function terra.profiler.print(profile,n)
+    n = n or 20
+    local total = math.max(1,profile.samples)
+    print(("%d samples (%d dropped)"):format(profile.samples,profile.dropped))
+    print(("%8s %8s  %s"):format("self%","total%","function"))
+    for i = 1,math.min(n,#profile.functions) do
+        local f = profile.functions[i]
+        print(("%8.2f %8.2f  %s"):format(100*f.self/total,100*f.total/total,f.name))
+    end
+    print()
+    print(("%8s  %s"):format("calls%","caller -> callee"))
+    for i = 1,math.min(n,#profile.calls) do
+        local c = profile.calls[i]
+        print(("%8.2f  %s -> %s"):format(100*c.count/total,c.caller,c.callee))
+    end
+end
+
+-- END PROFILER
+
 function terra.saveobj(filename,env,arguments)
     local cleanenv = {}
     for k,v in pairs(env) do
@@ -3788,6 +4541,9 @@ end
 terra.packages = {} --table of packages loaded using terralib.require()
 terra.path = os.getenv("TERRA_PATH") or "?.t"
 function terra.require(name)
+    if not terra.packages[name] and terra.builtinpackages[name] then --libraries shipped with terra (see terra.cpp)
+        terra.packages[name] = { results = {terra.builtinpackages[name]()} }
+    end
     if not terra.packages[name] then
         local fname = name:gsub("%.","/")
         local file = nil
@@ -3864,6 +4620,7 @@ terra.constantobj.__index = terra.constantobj
 --c.object is the cdata value for this object
 --string constants are handled specially since they should be treated as objects and not pointers
 --in this case c.object is a string rather than a cdata object
+--constant expressions have c.expression instead of c.object
 --c.type is the terra type
 
 
@@ -3871,23 +4628,73 @@ function terra.isconstant(obj)
     return getmetatable(obj) == terra.constantobj
 end
 
+--the type of a flat lua array of numbers: int[N] if every element is an integer, double[N] otherwise
+local function numericarraytype(tbl)
+    local N = #tbl
+    if N == 0 then
+        return nil
+    end
+    local allintegral = true
+    for i = 1,N do
+        local v = tbl[i]
+        if type(v) ~= "number" then
+            return nil
+        end
+        allintegral = allintegral and terralib.isintegral(v)
+    end
+    return terra.types.array((allintegral and int) or double,N)
+end
+
+--constant expressions (terralib.constant(`exp)) are typechecked as the body of an anonymous function that is never JITed,
+--functions they refer to are compiled on demand when code that uses the constant is emitted.
+--c.expression is the typed expression, which the compiler lowers to an LLVM constant
+local constantexpressionwrapper
+local function constantexpression(typ,q)
+    if not constantexpressionwrapper then --this file is plain lua, so the terra code is loaded on first use
+        constantexpressionwrapper = terra.loadstring [[
+            local exp,typ = ...
+            if typ then
+                return terra() : typ return [exp] end
+            else
+                return terra() return [exp] end
+            end
+        ]]
+    end
+    local definition = constantexpressionwrapper(q,typ):getdefinitions()[1]
+    definition:gettype()
+    local rstmt = definition.typedtree.body.statements[1]
+    if #definition.type.returns ~= 1 or not rstmt:is "return" or #rstmt.expressions.expressions ~= 1 then
+        error("expected a constant expression that produces a single value",3)
+    end
+    return setmetatable({ type = definition.type.returns[1], expression = rstmt.expressions.expressions[1] },terra.constantobj)
+end
+
 function terra.constant(a0,a1)
     if terra.types.istype(a0) then
+        if terra.isquote(a1) then
+            return constantexpression(a0,a1)
+        end
         local c = setmetatable({ type = a0, object = a1 },terra.constantobj)
         --special handling for string literals
         if type(c.object) == "string" and c.type == rawstring then
             return c
         end
 
-        --if the  object is not already cdata, we need to convert it
-        if  type(c.object) ~= "cdata" or terra.typeof(c.object) ~= c.type then
+        if type(c.object) == "table" and c.type:isaggregate() then
+            --tables (e.g. large lookup tables) are copied in a single step by the ffi's table initializer,
+            --the compiler then embeds the resulting memory as one block of constant data
+            c.object = terra.new(c.type,c.object)
+        elseif type(c.object) ~= "cdata" or terra.typeof(c.object) ~= c.type then
+            --if the object is not already cdata, we need to convert it
             c.object = terra.cast(c.type,c.object)
         end
         return c
     else
         --try to infer the type, and if successful build the constant
         local init,typ = a0,nil
-        if type(init) == "cdata" then
+        if terra.isquote(init) then
+            return constantexpression(nil,init)
+        elseif type(init) == "cdata" then
             typ = terra.typeof(init)
         elseif type(init) == "number" then
             typ = (terralib.isintegral(init) and int) or double
@@ -3895,6 +4702,8 @@ function terra.constant(a0,a1)
             typ = bool
         elseif type(init) == "string" then
             typ = rawstring
+        elseif type(init) == "table" and numericarraytype(init) then
+            typ = numericarraytype(init)
         else
             error("constant constructor requires explicit type for objects of type "..type(init))
         end
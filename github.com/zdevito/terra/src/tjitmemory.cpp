@@ -0,0 +1,189 @@
+/* See Copyright Notice in ../LICENSE.txt */
+
+#include "tjitmemory.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace llvm;
+
+#define BODY_ALIGNMENT 16
+#define DEFAULT_SLAB_SIZE (1 << 20)
+#define HUGE_PAGE_SIZE (2 << 20)
+//functions whose size is not known yet get a region of at least this size, so that most of them fit on the first try
+#define MIN_UNKNOWN_BODY_SIZE 4096
+
+static size_t RoundUp(size_t v, size_t align) {
+    return (v + align - 1) / align * align;
+}
+
+static bool EnvironmentFlag(const char * name) {
+    const char * v = getenv(name);
+    return v && strcmp(v,"") != 0 && strcmp(v,"0") != 0;
+}
+
+//slabs are readable, writable and executable, like the memory llvm's default manager hands out
+static uint8_t * MapSlab(size_t size, bool hugepages) {
+    int prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+    void * p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if(hugepages)
+        p = mmap(NULL, size, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if(p != MAP_FAILED)
+        return (uint8_t *) p;
+
+    //no reserved huge pages, so map an aligned region and ask for transparent huge pages instead
+    size_t extra = hugepages ? HUGE_PAGE_SIZE : 0;
+    p = mmap(NULL, size + extra, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+        return NULL;
+    if(extra) {
+        uintptr_t begin = (uintptr_t) p;
+        uintptr_t aligned = RoundUp(begin, HUGE_PAGE_SIZE);
+        if(aligned > begin)
+            munmap(p, aligned - begin);
+        if(begin + extra > aligned)
+            munmap((void *) (aligned + size), begin + extra - aligned);
+        p = (void *) aligned;
+#ifdef MADV_HUGEPAGE
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+    }
+    return (uint8_t *) p;
+}
+
+TerraJITMemoryManager::TerraJITMemoryManager()
+: base(JITMemoryManager::CreateDefaultMemManager()), livebytes(0), freebytes(0), reservedbytes(0) {
+    hugepages = EnvironmentFlag("TERRA_JIT_HUGEPAGES");
+    slabsize = hugepages ? HUGE_PAGE_SIZE : DEFAULT_SLAB_SIZE;
+}
+
+TerraJITMemoryManager::~TerraJITMemoryManager() {
+    for(std::map<uint8_t *, size_t>::iterator it = slabs.begin(), end = slabs.end(); it != end; ++it)
+        munmap(it->first, it->second);
+    delete base;
+}
+
+uint8_t * TerraJITMemoryManager::NewSlab(size_t minsize) {
+    size_t size = RoundUp(std::max(minsize, slabsize), slabsize);
+    uint8_t * slab = MapSlab(size, hugepages);
+    if(!slab)
+        report_fatal_error("terra: unable to allocate memory for JITed code");
+    slabs[slab] = size;
+    reservedbytes += size;
+    InsertFree(slab, size);
+    return slab;
+}
+
+void TerraJITMemoryManager::RemoveFree(std::map<uint8_t *, size_t>::iterator it) {
+    typedef std::multimap<size_t, uint8_t *>::iterator SizeIterator;
+    std::pair<SizeIterator,SizeIterator> range = freebysize.equal_range(it->second);
+    for(SizeIterator s = range.first; s != range.second; ++s) {
+        if(s->second == it->first) {
+            freebysize.erase(s);
+            break;
+        }
+    }
+    freebytes -= it->second;
+    freeblocks.erase(it);
+}
+
+void TerraJITMemoryManager::InsertFree(uint8_t * start, size_t size) {
+    freeblocks[start] = size;
+    freebysize.insert(std::make_pair(size, start));
+    freebytes += size;
+}
+
+void TerraJITMemoryManager::AddFree(uint8_t * start, size_t size) {
+    std::map<uint8_t *, size_t>::iterator slab = --slabs.upper_bound(start);
+    uint8_t * slabbegin = slab->first;
+    uint8_t * slabend = slab->first + slab->second;
+
+    //merge with the free regions on either side, as long as they are in the same slab
+    std::map<uint8_t *, size_t>::iterator next = freeblocks.lower_bound(start);
+    if(next != freeblocks.end() && next->first == start + size && next->first < slabend) {
+        size += next->second;
+        RemoveFree(next);
+    }
+    std::map<uint8_t *, size_t>::iterator prev = freeblocks.lower_bound(start);
+    if(prev != freeblocks.begin()) {
+        --prev;
+        if(prev->first >= slabbegin && prev->first + prev->second == start) {
+            start = prev->first;
+            size += prev->second;
+            RemoveFree(prev);
+        }
+    }
+
+    //an entirely free slab goes back to the OS, but we keep one around so that a process
+    //that repeatedly creates and deletes a few functions does not map and unmap memory each time
+    if(start == slabbegin && size == slab->second && slabs.size() > 1) {
+        munmap(start, size);
+        reservedbytes -= size;
+        slabs.erase(slab);
+        return;
+    }
+    InsertFree(start, size);
+}
+
+uint8_t * TerraJITMemoryManager::startFunctionBody(const Function * F, uintptr_t & ActualSize) {
+    std::multimap<size_t, uint8_t *>::iterator it;
+    size_t needed;
+    if(ActualSize == 0) {
+        //the size of the function is not known yet, give it the largest free region so it does not need to be emitted twice
+        needed = MIN_UNKNOWN_BODY_SIZE;
+        it = freebysize.end();
+        if(!freebysize.empty() && (--freebysize.end())->first >= needed)
+            it = --freebysize.end();
+    } else {
+        //a retry after running out of space, or the JIT knows the size: take the smallest region that fits
+        needed = RoundUp(ActualSize, BODY_ALIGNMENT);
+        it = freebysize.lower_bound(needed);
+    }
+    uint8_t * start = (it == freebysize.end()) ? NewSlab(needed) : it->second;
+    std::map<uint8_t *, size_t>::iterator block = freeblocks.find(start);
+    assert(block != freeblocks.end());
+    ActualSize = block->second;
+    RemoveFree(block);
+    //the whole region belongs to the function until endFunctionBody returns the unused part
+    functionbodies[start] = ActualSize;
+    return start;
+}
+
+void TerraJITMemoryManager::endFunctionBody(const Function * F, uint8_t * FunctionStart, uint8_t * FunctionEnd) {
+    std::map<uint8_t *, size_t>::iterator it = functionbodies.find(FunctionStart);
+    assert(it != functionbodies.end());
+    size_t used = std::max(RoundUp(FunctionEnd - FunctionStart, BODY_ALIGNMENT), (size_t) BODY_ALIGNMENT);
+    if(used < it->second) {
+        AddFree(FunctionStart + used, it->second - used);
+        it->second = used;
+    }
+    livebytes += it->second;
+}
+
+void TerraJITMemoryManager::deallocateFunctionBody(void * Body) {
+    std::map<uint8_t *, size_t>::iterator it = functionbodies.find((uint8_t *) Body);
+    if(it == functionbodies.end())
+        return;
+    uint8_t * start = it->first;
+    size_t size = it->second;
+    livebytes -= size;
+    functionbodies.erase(it);
+    AddFree(start, size);
+}
+
+void TerraJITMemoryManager::GetStats(terra_JITMemoryStats * stats) {
+    stats->live = livebytes;
+    stats->free = freebytes;
+    stats->largestfree = freebysize.empty() ? 0 : (--freebysize.end())->first;
+    stats->reserved = reservedbytes;
+    stats->slabs = slabs.size();
+    stats->functions = functionbodies.size();
+}
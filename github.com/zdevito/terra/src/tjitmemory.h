@@ -0,0 +1,78 @@
+#ifndef tjitmemory_h
+#define tjitmemory_h
+
+#include <map>
+#include "llvmheaders.h"
+#include "llvm/ExecutionEngine/JITMemoryManager.h"
+
+//memory manager for the JIT that places function bodies in large slabs of executable memory
+//freed bodies (see terra_deletefunction) go back to a free list and are reused by later functions,
+//and slabs that become completely free are returned to the OS (except for the last one)
+//if TERRA_JIT_HUGEPAGES is set, slabs are 2MB and backed by huge pages when the system has them, reducing iTLB misses
+//stubs, globals and exception tables are left to llvm's default memory manager
+//exposed to lua as terra.jitmemory and terra.setjitmemorylimit
+
+struct terra_JITMemoryStats {
+    size_t live; //bytes used by function bodies
+    size_t free; //bytes in slabs that are available for new functions
+    size_t largestfree; //size of the largest free region, free - largestfree is a measure of fragmentation
+    size_t reserved; //bytes in all slabs
+    size_t slabs;
+    size_t functions;
+};
+
+class TerraJITMemoryManager : public llvm::JITMemoryManager {
+    llvm::JITMemoryManager * base;
+    bool hugepages;
+    size_t slabsize;
+    std::map<uint8_t *, size_t> slabs; //start -> size
+    std::map<uint8_t *, size_t> freeblocks; //start -> size, adjacent free blocks in the same slab are merged
+    std::multimap<size_t, uint8_t *> freebysize;
+    std::map<uint8_t *, size_t> functionbodies; //start -> size
+    size_t livebytes;
+    size_t freebytes;
+    size_t reservedbytes;
+
+    uint8_t * NewSlab(size_t minsize);
+    void InsertFree(uint8_t * start, size_t size);
+    void AddFree(uint8_t * start, size_t size); //InsertFree after merging with neighboring free regions
+    void RemoveFree(std::map<uint8_t *, size_t>::iterator it);
+public:
+    TerraJITMemoryManager();
+    virtual ~TerraJITMemoryManager();
+    void GetStats(terra_JITMemoryStats * stats);
+
+    virtual uint8_t * startFunctionBody(const llvm::Function * F, uintptr_t & ActualSize);
+    virtual void endFunctionBody(const llvm::Function * F, uint8_t * FunctionStart, uint8_t * FunctionEnd);
+    virtual void deallocateFunctionBody(void * Body);
+
+    //the rest is handled by base
+    virtual void setMemoryWritable() { base->setMemoryWritable(); }
+    virtual void setMemoryExecutable() { base->setMemoryExecutable(); }
+    virtual void setPoisonMemory(bool poison) { base->setPoisonMemory(poison); }
+    virtual void AllocateGOT() { HasGOT = true; base->AllocateGOT(); }
+    virtual uint8_t * getGOTBase() const { return base->getGOTBase(); }
+    virtual uint8_t * allocateStub(const llvm::GlobalValue * F, unsigned StubSize, unsigned Alignment) {
+        return base->allocateStub(F, StubSize, Alignment);
+    }
+    virtual uint8_t * allocateSpace(intptr_t Size, unsigned Alignment) { return base->allocateSpace(Size, Alignment); }
+    virtual uint8_t * allocateGlobal(uintptr_t Size, unsigned Alignment) { return base->allocateGlobal(Size, Alignment); }
+    virtual uint8_t * startExceptionTable(const llvm::Function * F, uintptr_t & ActualSize) {
+        return base->startExceptionTable(F, ActualSize);
+    }
+    virtual void endExceptionTable(const llvm::Function * F, uint8_t * TableStart, uint8_t * TableEnd, uint8_t * FrameRegister) {
+        base->endExceptionTable(F, TableStart, TableEnd, FrameRegister);
+    }
+    virtual void deallocateExceptionTable(void * ET) { base->deallocateExceptionTable(ET); }
+    virtual uint8_t * allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID) {
+        return base->allocateCodeSection(Size, Alignment, SectionID);
+    }
+    virtual uint8_t * allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID) {
+        return base->allocateDataSection(Size, Alignment, SectionID);
+    }
+    virtual void * getPointerToNamedFunction(const std::string & Name, bool AbortOnFailure = true) {
+        return base->getPointerToNamedFunction(Name, AbortOnFailure);
+    }
+};
+
+#endif
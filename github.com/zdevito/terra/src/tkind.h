@@ -90,7 +90,13 @@ _(numbertoken, "<number>") \
 _(stringtoken, "<string>") \
 _(eostoken, "<eof>") \
 _(constant,"constant") \
-_(truncate, "truncate")
+_(truncate, "truncate") \
+_(gather, "gather") \
+_(scatter, "scatter") \
+_(shuffle, "shuffle") \
+_(atomic, "atomic") \
+_(loophint, "loophint") \
+_(prefetch, "prefetch")
 
 enum T_Kind {
     #define T_KIND_ENUM(a,str) T_##a,
@@ -3,6 +3,7 @@
 #include "tllvmutil.h"
 #include "llvm/Target/TargetLibraryInfo.h"
 #include "llvm-c/Disassembler.h"
+#include <pthread.h>
 using namespace llvm;
 
 void llvmutil_addtargetspecificpasses(PassManagerBase * fpm, TargetMachine * TM) {
@@ -87,21 +88,36 @@ void llvmutil_addoptimizationpasses(FunctionPassManager * fpm, const OptInfo * o
     fpm->add(createInstructionCombiningPass());  // Clean up after everything.
 }
 
+//the target's disassembler is not initialized by InitializeNativeTarget
+static pthread_once_t disassemblerinitonce = PTHREAD_ONCE_INIT;
+static void InitializeDisassembler() {
+#if defined(__x86_64__) || defined(__i386__)
+    LLVMInitializeX86Disassembler();
+#endif
+}
+
 void llvmutil_disassemblefunction(void * data, size_t sz) {
-#ifndef __linux__
+    pthread_once(&disassemblerinitonce, InitializeDisassembler);
     printf("assembly for function at address %p\n",data);
     LLVMDisasmContextRef disasm = LLVMCreateDisasm(llvm::sys::getDefaultTargetTriple().c_str(),NULL,0,NULL,NULL);
-    assert(disasm != NULL);
+    if(disasm == NULL) {
+        printf("no disassembler available for %s\n",llvm::sys::getDefaultTargetTriple().c_str());
+        return;
+    }
     char buf[1024];
     buf[0] = '\0';
     int64_t offset = 0;
     while(offset < sz) {
-        int64_t inc = LLVMDisasmInstruction(disasm, (uint8_t*)data + offset, sz - offset, 0, buf,1024);
-        printf("%d:\t%s\n",(int)offset,buf);
+        int64_t inc = LLVMDisasmInstruction(disasm, (uint8_t*)data + offset, sz - offset, (uint64_t)data + offset, buf,1024);
+        if(inc == 0) { //not a valid instruction, skip a byte
+            printf("%d:\t<invalid>\n",(int)offset);
+            inc = 1;
+        } else {
+            printf("%d:\t%s\n",(int)offset,buf);
+        }
         offset += inc;
     }
     LLVMDisasmDispose(disasm);
-#endif
 }
 
 //adapted from LLVM's C interface "LLVMTargetMachineEmitToFile"
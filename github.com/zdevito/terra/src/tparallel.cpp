@@ -0,0 +1,220 @@
+/* See Copyright Notice in ../LICENSE.txt */
+
+#include "tparallel.h"
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+}
+
+#include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <deque>
+
+#include "terrastate.h"
+
+//work-stealing pool used by parallel for loops
+//each worker owns a deque of iteration ranges. A worker splits the range it is running in half,
+//keeping the lower half and pushing the upper half onto the back of its own deque. Idle workers
+//steal from the front of other deques, where the largest (earliest pushed) ranges are.
+//the thread that starts a loop participates as worker 0, so the pool only creates nworkers-1 threads
+
+struct Range {
+    int64_t begin, end;
+};
+
+struct Job {
+    terra_ParallelBody body;
+    void * env;
+    int64_t grain;
+    volatile int64_t remaining; //iterations that have not finished yet
+};
+
+struct Worker {
+    pthread_mutex_t lock;
+    std::deque<Range> tasks;
+};
+
+struct ThreadPool {
+    int nworkers;
+    Worker * workers;
+    pthread_mutex_t lock; //protects job, generation and active
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    Job * job;
+    uint64_t generation;
+    int active; //pool threads currently working on job
+    pthread_mutex_t joblock; //only one loop runs on the pool at a time
+};
+
+static ThreadPool pool;
+static pthread_once_t poolonce = PTHREAD_ONCE_INIT;
+static __thread int inworker = 0;
+
+static void pushtask(int id, Range r) {
+    Worker * w = &pool.workers[id];
+    pthread_mutex_lock(&w->lock);
+    w->tasks.push_back(r);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static bool poptask(int id, Range * r) {
+    Worker * w = &pool.workers[id];
+    bool found = false;
+    pthread_mutex_lock(&w->lock);
+    if(!w->tasks.empty()) {
+        *r = w->tasks.back();
+        w->tasks.pop_back();
+        found = true;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return found;
+}
+
+static bool stealtask(int id, Range * r) {
+    for(int i = 1; i < pool.nworkers; i++) {
+        Worker * w = &pool.workers[(id + i) % pool.nworkers];
+        bool found = false;
+        pthread_mutex_lock(&w->lock);
+        if(!w->tasks.empty()) {
+            *r = w->tasks.front();
+            w->tasks.pop_front();
+            found = true;
+        }
+        pthread_mutex_unlock(&w->lock);
+        if(found)
+            return true;
+    }
+    return false;
+}
+
+static void runtask(int id, Job * job, Range r) {
+    while(r.end - r.begin > job->grain) {
+        int64_t mid = r.begin + (r.end - r.begin) / 2;
+        Range upper = { mid, r.end };
+        pushtask(id,upper);
+        r.end = mid;
+    }
+    job->body(job->env,r.begin,r.end);
+    __sync_fetch_and_sub(&job->remaining, r.end - r.begin);
+}
+
+static void participate(int id, Job * job) {
+    while(job->remaining > 0) {
+        Range r;
+        if(poptask(id,&r) || stealtask(id,&r))
+            runtask(id,job,r);
+        else
+            sched_yield();
+    }
+}
+
+static void * workermain(void * arg) {
+    int id = (int)(intptr_t) arg;
+    inworker = 1;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    while(true) {
+        while(pool.job == NULL || pool.generation == seen)
+            pthread_cond_wait(&pool.wake,&pool.lock);
+        seen = pool.generation;
+        Job * job = pool.job;
+        pool.active++;
+        pthread_mutex_unlock(&pool.lock);
+
+        participate(id,job);
+
+        pthread_mutex_lock(&pool.lock);
+        if(--pool.active == 0)
+            pthread_cond_broadcast(&pool.done);
+    }
+    return NULL;
+}
+
+static void initpool() {
+    int n = 0;
+    if(const char * s = getenv("TERRA_NUM_THREADS"))
+        n = atoi(s);
+    if(n <= 0)
+        n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if(n <= 0)
+        n = 1;
+    pool.nworkers = n;
+    pool.workers = new Worker[n];
+    for(int i = 0; i < n; i++)
+        pthread_mutex_init(&pool.workers[i].lock,NULL);
+    pthread_mutex_init(&pool.lock,NULL);
+    pthread_mutex_init(&pool.joblock,NULL);
+    pthread_cond_init(&pool.wake,NULL);
+    pthread_cond_init(&pool.done,NULL);
+    pool.job = NULL;
+    pool.generation = 0;
+    pool.active = 0;
+    for(int i = 1; i < n; i++) {
+        pthread_t thread;
+        pthread_create(&thread,NULL,workermain,(void*)(intptr_t)i);
+        pthread_detach(thread);
+    }
+}
+
+void terra_parallelfor(int64_t begin, int64_t end, int64_t grain, terra_ParallelBody body, void * env) {
+    if(end <= begin)
+        return;
+    pthread_once(&poolonce,initpool);
+    if(grain <= 0) {
+        grain = (end - begin) / (8 * pool.nworkers);
+        if(grain < 1)
+            grain = 1;
+    }
+    if(inworker || pool.nworkers == 1 || end - begin <= grain) {
+        body(env,begin,end);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.joblock);
+    Job job;
+    job.body = body;
+    job.env = env;
+    job.grain = grain;
+    job.remaining = end - begin;
+    Range all = { begin, end };
+    pushtask(0,all);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.job = &job;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    inworker = 1;
+    participate(0,&job);
+    inworker = 0;
+
+    //job lives on this stack, so wait for every worker to stop looking at it
+    pthread_mutex_lock(&pool.lock);
+    pool.job = NULL;
+    while(pool.active > 0)
+        pthread_cond_wait(&pool.done,&pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.joblock);
+}
+
+static int terra_parallelnumthreads(lua_State * L) {
+    pthread_once(&poolonce,initpool);
+    lua_pushnumber(L,pool.nworkers);
+    return 1;
+}
+
+int terra_parallelinit(struct terra_State * T) {
+    lua_getfield(T->L,LUA_GLOBALSINDEX,"terra");
+    lua_pushlightuserdata(T->L,(void*)terra_parallelfor);
+    lua_setfield(T->L,-2,"parallelforimpl");
+    lua_pushcfunction(T->L,terra_parallelnumthreads);
+    lua_setfield(T->L,-2,"parallelnumthreads");
+    lua_pop(T->L,1);
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef tparallel_h
+#define tparallel_h
+
+#include <stdint.h>
+
+struct terra_State;
+int terra_parallelinit(struct terra_State * T);
+
+typedef void (*terra_ParallelBody)(void * env, int64_t begin, int64_t end);
+
+//calls body on disjoint subranges that cover [begin,end), using a shared work-stealing thread pool
+//ranges are split until they are no larger than grain (grain <= 0 picks a size based on the number of threads)
+//returns when all iterations have completed. parallel loops nested inside a body run serially
+void terra_parallelfor(int64_t begin, int64_t end, int64_t grain, terra_ParallelBody body, void * env);
+
+#endif
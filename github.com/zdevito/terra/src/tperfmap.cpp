@@ -0,0 +1,185 @@
+/* See Copyright Notice in ../LICENSE.txt */
+
+#include "tperfmap.h"
+
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+//the perf map is a text file with one "start size name" line per function (all hex)
+//the jitdump format is described in tools/perf/Documentation/jitdump-specification.txt in the linux sources
+
+#define JITDUMP_MAGIC 0x4A695444
+#define JITDUMP_VERSION 1
+
+enum {
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_DEBUG_INFO = 2,
+};
+
+struct JitHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct JitRecordHeader {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct JitCodeLoad {
+    JitRecordHeader p;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    //followed by the null-terminated name and the code bytes
+};
+
+struct JitDebugInfo {
+    JitRecordHeader p;
+    uint64_t code_addr;
+    uint64_t nr_entry;
+    //followed by nr_entry entries of { uint64_t addr; int lineno; int discrim; char filename[]; }
+};
+
+static pthread_mutex_t perflock = PTHREAD_MUTEX_INITIALIZER;
+static bool initialized = false;
+static FILE * perfmap = NULL;
+static FILE * jitdump = NULL;
+static uint64_t codeindex = 0;
+
+//perf records with the monotonic clock when given -k mono, so the records must use the same one
+static uint64_t Timestamp() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool EnvironmentFlag(const char * name) {
+    const char * v = getenv(name);
+    return v && strcmp(v,"") != 0 && strcmp(v,"0") != 0;
+}
+
+static void OpenJitDump() {
+    char filename[64];
+    snprintf(filename, sizeof(filename), "/tmp/jit-%d.dump", (int) getpid());
+    int fd = open(filename, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if(fd < 0)
+        return;
+    //perf finds the dump through the mmap event for this file, so it has to be mapped executable
+    void * marker = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    if(marker == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+    jitdump = fdopen(fd, "wb");
+    if(!jitdump)
+        return;
+    JitHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = JITDUMP_MAGIC;
+    h.version = JITDUMP_VERSION;
+    h.total_size = sizeof(h);
+#if defined(__x86_64__)
+    h.elf_mach = EM_X86_64;
+#elif defined(__i386__)
+    h.elf_mach = EM_386;
+#elif defined(__arm__)
+    h.elf_mach = EM_ARM;
+#endif
+    h.pid = getpid();
+    h.timestamp = Timestamp();
+    fwrite(&h, sizeof(h), 1, jitdump);
+    fflush(jitdump);
+}
+
+void terra_perfmapinit() {
+    pthread_mutex_lock(&perflock);
+    if(!initialized) {
+        initialized = true;
+        if(EnvironmentFlag("TERRA_PERFMAP")) {
+            char filename[64];
+            snprintf(filename, sizeof(filename), "/tmp/perf-%d.map", (int) getpid());
+            perfmap = fopen(filename, "w");
+        }
+        if(EnvironmentFlag("TERRA_JITDUMP"))
+            OpenJitDump();
+    }
+    pthread_mutex_unlock(&perflock);
+}
+
+static void WriteDebugInfo(void * addr, const std::vector<terra_LineEntry> & lines, uint64_t timestamp) {
+    uint32_t size = sizeof(JitDebugInfo);
+    for(size_t i = 0; i < lines.size(); i++)
+        size += sizeof(uint64_t) + 2*sizeof(int) + strlen(lines[i].filename) + 1;
+    JitDebugInfo d;
+    d.p.id = JIT_CODE_DEBUG_INFO;
+    d.p.total_size = size;
+    d.p.timestamp = timestamp;
+    d.code_addr = (uint64_t) addr;
+    d.nr_entry = lines.size();
+    fwrite(&d, sizeof(d), 1, jitdump);
+    for(size_t i = 0; i < lines.size(); i++) {
+        int discrim = 0;
+        fwrite(&lines[i].address, sizeof(uint64_t), 1, jitdump);
+        fwrite(&lines[i].line, sizeof(int), 1, jitdump);
+        fwrite(&discrim, sizeof(int), 1, jitdump);
+        fwrite(lines[i].filename, strlen(lines[i].filename) + 1, 1, jitdump);
+    }
+}
+
+void terra_perfmapfunction(const char * name, void * addr, size_t size, const std::vector<terra_LineEntry> & lines) {
+    if(!perfmap && !jitdump)
+        return;
+    pthread_mutex_lock(&perflock);
+    if(perfmap) {
+        fprintf(perfmap, "%lx %lx %s\n", (unsigned long) addr, (unsigned long) size, name);
+        fflush(perfmap);
+    }
+    if(jitdump) {
+        uint64_t timestamp = Timestamp();
+        if(lines.size() > 0) //debug info has to come before the code it describes
+            WriteDebugInfo(addr, lines, timestamp);
+        JitCodeLoad r;
+        r.p.id = JIT_CODE_LOAD;
+        r.p.total_size = sizeof(r) + strlen(name) + 1 + size;
+        r.p.timestamp = timestamp;
+        r.pid = getpid();
+        r.tid = syscall(SYS_gettid);
+        r.vma = (uint64_t) addr;
+        r.code_addr = (uint64_t) addr;
+        r.code_size = size;
+        r.code_index = codeindex++;
+        fwrite(&r, sizeof(r), 1, jitdump);
+        fwrite(name, strlen(name) + 1, 1, jitdump);
+        fwrite(addr, size, 1, jitdump);
+        fflush(jitdump);
+    }
+    pthread_mutex_unlock(&perflock);
+}
+
+#else
+
+void terra_perfmapinit() {}
+void terra_perfmapfunction(const char * name, void * addr, size_t size, const std::vector<terra_LineEntry> & lines) {}
+
+#endif
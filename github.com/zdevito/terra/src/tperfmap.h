@@ -0,0 +1,23 @@
+#ifndef tperfmap_h
+#define tperfmap_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//tells external profilers (linux perf) where JITed functions live
+//if TERRA_PERFMAP is set, each function is appended to /tmp/perf-<pid>.map, which perf uses to name samples in JITed code
+//if TERRA_JITDUMP is set, each function's code (and line table, if any) is written to /tmp/jit-<pid>.dump for use with
+//"perf record -k mono" followed by "perf inject --jit"
+//on other platforms these are no-ops
+
+struct terra_LineEntry {
+    uint64_t address;
+    int line;
+    const char * filename;
+};
+
+void terra_perfmapinit();
+void terra_perfmapfunction(const char * name, void * addr, size_t size, const std::vector<terra_LineEntry> & lines);
+
+#endif
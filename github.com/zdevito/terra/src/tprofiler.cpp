@@ -0,0 +1,281 @@
+/* See Copyright Notice in ../LICENSE.txt */
+
+#include "tprofiler.h"
+
+extern "C" {
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+}
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "terrastate.h"
+
+//the signal handler only copies registers and walks the frame-pointer chain, so it never allocates or takes locks
+//each sample claims a slot in the buffer with an atomic increment; once the buffer is full, further samples are counted as dropped
+//JITed code keeps its frame pointers (see terra_compilerinit), so chains through terra functions are complete.
+//code compiled without frame pointers (e.g. parts of libc or LuaJIT) shortens the chain instead of corrupting it,
+//since every frame must lie above the previous one and inside the profiled thread's stack
+
+#define MAX_DEPTH 32
+#define MAX_SAMPLES 20000
+
+struct Sample {
+    int depth; //0 until the slot is completely written
+    void * pcs[MAX_DEPTH]; //innermost frame first
+};
+
+static Sample * samples = NULL;
+static volatile int nsamples = 0;
+static bool running = false;
+static struct sigaction oldaction;
+
+//bounds of the stack of the thread that started the profiler, only samples taken on it are walked
+static pthread_t profiledthread;
+static char * stacklow = NULL;
+static char * stackhigh = NULL;
+
+struct CodeRange {
+    uintptr_t begin, end;
+    const void * fn;
+    std::string name;
+    bool operator<(const CodeRange & rhs) const { return begin < rhs.begin; }
+};
+
+static pthread_mutex_t rangelock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<CodeRange> ranges; //sorted by begin
+
+void terra_profileraddfunction(const void * fn, const char * name, void * addr, size_t size) {
+    CodeRange r;
+    r.begin = (uintptr_t) addr;
+    r.end = r.begin + size;
+    r.fn = fn;
+    r.name = name;
+    pthread_mutex_lock(&rangelock);
+    ranges.insert(std::upper_bound(ranges.begin(), ranges.end(), r), r);
+    pthread_mutex_unlock(&rangelock);
+}
+
+void terra_profilerremovefunction(const void * fn) {
+    pthread_mutex_lock(&rangelock);
+    for(size_t i = 0; i < ranges.size();) {
+        if(ranges[i].fn == fn)
+            ranges.erase(ranges.begin() + i);
+        else
+            i++;
+    }
+    pthread_mutex_unlock(&rangelock);
+}
+
+//must be called with rangelock held
+static const CodeRange * FindRange(uintptr_t pc) {
+    CodeRange key;
+    key.begin = pc;
+    std::vector<CodeRange>::iterator it = std::upper_bound(ranges.begin(), ranges.end(), key);
+    if(it == ranges.begin())
+        return NULL;
+    --it;
+    return (pc < it->end) ? &*it : NULL;
+}
+
+static bool GetRegisters(void * context, void ** pc, void ** fp, void ** sp) {
+    ucontext_t * uc = (ucontext_t *) context;
+#if defined(__linux__) && defined(__x86_64__)
+    *pc = (void*) uc->uc_mcontext.gregs[REG_RIP];
+    *fp = (void*) uc->uc_mcontext.gregs[REG_RBP];
+    *sp = (void*) uc->uc_mcontext.gregs[REG_RSP];
+    return true;
+#elif defined(__linux__) && defined(__i386__)
+    *pc = (void*) uc->uc_mcontext.gregs[REG_EIP];
+    *fp = (void*) uc->uc_mcontext.gregs[REG_EBP];
+    *sp = (void*) uc->uc_mcontext.gregs[REG_ESP];
+    return true;
+#elif defined(__APPLE__) && defined(__x86_64__)
+    *pc = (void*) uc->uc_mcontext->__ss.__rip;
+    *fp = (void*) uc->uc_mcontext->__ss.__rbp;
+    *sp = (void*) uc->uc_mcontext->__ss.__rsp;
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void ProfileHandler(int sig, siginfo_t * info, void * context) {
+    int savederrno = errno;
+    void * pc, * fp, * sp;
+    if(GetRegisters(context, &pc, &fp, &sp)) {
+        int idx = __sync_fetch_and_add(&nsamples, 1);
+        if(idx < MAX_SAMPLES) {
+            Sample * s = &samples[idx];
+            int depth = 0;
+            s->pcs[depth++] = pc;
+            char * frame = (char*) fp;
+            char * limit = (char*) sp;
+            if(pthread_equal(pthread_self(), profiledthread) && limit >= stacklow && limit < stackhigh) {
+                //each frame holds the caller's frame pointer followed by the return address
+                while(depth < MAX_DEPTH && frame >= limit && frame + 2*sizeof(void*) <= stackhigh
+                      && ((uintptr_t) frame % sizeof(void*)) == 0) {
+                    void ** f = (void**) frame;
+                    if(f[1] == NULL)
+                        break;
+                    s->pcs[depth++] = f[1];
+                    limit = frame + 2*sizeof(void*);
+                    frame = (char*) f[0];
+                }
+            }
+            __sync_synchronize();
+            s->depth = depth;
+        }
+    }
+    errno = savederrno;
+}
+
+static void GetStackBounds() {
+    profiledthread = pthread_self();
+#if defined(__linux__)
+    pthread_attr_t attr;
+    void * addr;
+    size_t size;
+    if(pthread_getattr_np(pthread_self(), &attr) == 0) {
+        pthread_attr_getstack(&attr, &addr, &size);
+        pthread_attr_destroy(&attr);
+        stacklow = (char*) addr;
+        stackhigh = stacklow + size;
+    }
+#elif defined(__APPLE__)
+    stackhigh = (char*) pthread_get_stackaddr_np(pthread_self());
+    stacklow = stackhigh - pthread_get_stacksize_np(pthread_self());
+#endif
+}
+
+static int terra_profilerstart(lua_State * L) {
+    double hz = luaL_optnumber(L, 1, 1000);
+    if(running)
+        luaL_error(L, "the profiler is already running");
+    if(hz <= 0 || hz > 1000000)
+        luaL_error(L, "expected a sampling rate between 0 and 1000000 samples per second but found %f", hz);
+    if(!samples) {
+        samples = (Sample*) malloc(sizeof(Sample) * MAX_SAMPLES);
+        if(!samples)
+            luaL_error(L, "out of memory allocating profiler samples");
+    }
+    memset(samples, 0, sizeof(Sample) * MAX_SAMPLES);
+    nsamples = 0;
+    GetStackBounds();
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = ProfileHandler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGPROF, &sa, &oldaction) != 0)
+        luaL_error(L, "failed to install the SIGPROF handler: %s", strerror(errno));
+
+    long usec = (long) (1000000.0 / hz);
+    struct itimerval timer;
+    timer.it_interval.tv_sec = usec / 1000000;
+    timer.it_interval.tv_usec = (usec % 1000000) + (usec == 0);
+    timer.it_value = timer.it_interval;
+    if(setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        sigaction(SIGPROF, &oldaction, NULL);
+        luaL_error(L, "failed to start the profiling timer: %s", strerror(errno));
+    }
+    running = true;
+    return 0;
+}
+
+static int terra_profilerstop(lua_State * L) {
+    if(!running)
+        return 0;
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &oldaction, NULL);
+    running = false;
+    return 0;
+}
+
+//names code outside of JITed functions: the symbol if there is one, otherwise the image it belongs to
+static const std::string & SymbolName(std::map<void*,std::string> & cache, void * pc) {
+    std::map<void*,std::string>::iterator it = cache.find(pc);
+    if(it != cache.end())
+        return it->second;
+    std::string & name = cache[pc];
+    Dl_info info;
+    if(!dladdr(pc, &info)) {
+        name = "[unknown]";
+    } else if(info.dli_sname) {
+        name = info.dli_sname;
+    } else if(info.dli_fname) {
+        const char * base = strrchr(info.dli_fname, '/');
+        name = std::string("[") + (base ? base + 1 : info.dli_fname) + "]";
+    } else {
+        name = "[unknown]";
+    }
+    return name;
+}
+
+//returns the samples recorded by the last run as a list of stacks, innermost frame first
+//a frame in a JITed function is the function's llvm_function (a lightuserdata), any other frame is a symbol name
+//also returns a table from llvm_function to the name of the LLVM function, and the number of dropped samples
+static int terra_profilersamples(lua_State * L) {
+    int n = std::min((int) nsamples, MAX_SAMPLES);
+    int dropped = nsamples - n;
+    std::map<void*,std::string> symbols;
+    lua_newtable(L); //samples
+    lua_newtable(L); //names
+    int samplestbl = lua_gettop(L) - 1;
+    int namestbl = samplestbl + 1;
+    int nvalid = 0;
+    pthread_mutex_lock(&rangelock);
+    for(int i = 0; i < n; i++) {
+        Sample * s = &samples[i];
+        if(s->depth == 0)
+            continue;
+        lua_createtable(L, s->depth, 0);
+        for(int d = 0; d < s->depth; d++) {
+            //return addresses point after the call, which may be the first byte of the next function
+            uintptr_t pc = (uintptr_t) s->pcs[d] - (d > 0);
+            const CodeRange * r = FindRange(pc);
+            if(r) {
+                lua_pushlightuserdata(L, (void*) r->fn);
+                lua_pushstring(L, r->name.c_str());
+                lua_settable(L, namestbl);
+                lua_pushlightuserdata(L, (void*) r->fn);
+            } else {
+                lua_pushstring(L, SymbolName(symbols, (void*) pc).c_str());
+            }
+            lua_rawseti(L, -2, d + 1);
+        }
+        lua_rawseti(L, samplestbl, ++nvalid);
+    }
+    pthread_mutex_unlock(&rangelock);
+    lua_pushnumber(L, dropped);
+    return 3;
+}
+
+int terra_profilerinit(struct terra_State * T) {
+    lua_getfield(T->L,LUA_GLOBALSINDEX,"terra");
+    lua_pushcfunction(T->L,terra_profilerstart);
+    lua_setfield(T->L,-2,"profilerstartimpl");
+    lua_pushcfunction(T->L,terra_profilerstop);
+    lua_setfield(T->L,-2,"profilerstopimpl");
+    lua_pushcfunction(T->L,terra_profilersamples);
+    lua_setfield(T->L,-2,"profilersamples");
+    lua_pop(T->L,1);
+    return 0;
+}
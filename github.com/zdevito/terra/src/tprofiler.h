@@ -0,0 +1,19 @@
+#ifndef tprofiler_h
+#define tprofiler_h
+
+#include <stddef.h>
+
+//in-process sampling profiler
+//while running, a SIGPROF timer records the program counter and the frame-pointer call chain of the interrupted code
+//into a preallocated buffer. Nothing is resolved in the signal handler: addresses are mapped to JITed functions
+//(registered below as they are emitted) or to symbols of the executable and shared libraries when the samples are read
+//exposed to lua as terra.profilerstartimpl, terra.profilerstopimpl and terra.profilersamples, see terra.profiler in terralib.lua
+
+struct terra_State;
+int terra_profilerinit(struct terra_State * T);
+
+//record that the code for fn (an llvm::Function) lives at [addr,addr+size)
+void terra_profileraddfunction(const void * fn, const char * name, void * addr, size_t size);
+void terra_profilerremovefunction(const void * fn);
+
+#endif
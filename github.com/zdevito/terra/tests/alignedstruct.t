@@ -0,0 +1,49 @@
+struct A {
+	a : int8;
+	b : float[8];
+	c : int8;
+}
+A.entries[2].align = 64
+
+struct B {
+	x : int;
+}
+B.alignment = 64
+
+struct C {
+	a : int8;
+	b : B; --B's alignment propagates to the field
+	c : B[2];
+}
+
+g = global(float[16],nil,128)
+
+terra offsets()
+	var a : A
+	var c : C
+	var b : B[3]
+	return [int64](&a.b) - [int64](&a), [int64](&c.b) - [int64](&c), [int64](&c.c[1]) - [int64](&c), sizeof(A), sizeof(B)
+end
+
+terra addresses()
+	var b : B
+	var a : A
+	return [int64](&b) % 64, [int64](&a) % 64, [int64](&g) % 128
+end
+
+terra store(a : &A, v : float)
+	a.b[7] = v
+	a.c = 3
+end
+
+local test = require("test")
+test.meq({64,64,192,128,64},offsets())
+test.meq({0,0,0},addresses())
+
+--the lua view of the struct has the same layout
+test.eq(terralib.offsetof(A,"b"),64)
+test.eq(terralib.sizeof(A),128)
+local a = terralib.new(A)
+store(a,2)
+test.eq(a.b[7],2)
+test.eq(a.c,3)
@@ -0,0 +1,144 @@
+local alloc = terralib.require("std.alloc")
+C = terralib.includecstring [[
+#include <pthread.h>
+]]
+
+struct Point {
+	x : int;
+	y : int;
+}
+
+terra arena()
+	var a : alloc.Arena
+	a:init(256)
+	var sum = 0
+	for round = 0,3 do
+		--more than one chunk's worth, so the arena has to grow
+		var ps = a:new(Point,100)
+		for i = 0,100 do
+			ps[i].x = i
+			ps[i].y = round
+		end
+		var v = a:new([vector(float,4)])
+		@v = vector(1.f,2.f,3.f,4.f)
+		for i = 0,100 do
+			sum = sum + ps[i].x + ps[i].y
+		end
+		sum = sum + [int]((@v)[3])
+		if [int64](v) % 16 ~= 0 then
+			return -1
+		end
+		a:reset()
+	end
+	a:free()
+	return sum
+end
+
+terra bump()
+	var b : alloc.Bump
+	b:init(64)
+	var x = b:new(int,4)
+	var m = b:mark()
+	var y = b:new(int,8)
+	var full = b:new(int,8) --does not fit
+	b:rewind(m)
+	var z = b:new(int,8) --reuses y's space
+	var r = [int](full == nil) + [int](y == z) + [int](x ~= y)
+	b:free()
+	return r
+end
+
+local IntArena = alloc.TypedArena(int)
+assert(IntArena == alloc.TypedArena(int))
+terra typedarena()
+	var a : IntArena
+	a:init(16)
+	var xs = a:new(10)
+	var ys = a:new(10)
+	for i = 0,10 do
+		xs[i] = i
+		ys[i] = 2*i
+	end
+	var s = 0
+	for i = 0,10 do
+		s = s + xs[i] + ys[i]
+	end
+	a:free()
+	return s
+end
+
+local PointPool = alloc.Pool(Point)
+assert(PointPool == alloc.Pool(Point))
+
+struct Worker {
+	pool : &PointPool;
+	sum : int;
+}
+
+terra work(arg : &uint8) : &uint8
+	var w = [&Worker](arg)
+	var ps : (&Point)[100]
+	for round = 0,10 do
+		for i = 0,100 do
+			ps[i] = w.pool:alloc()
+			ps[i].x = i
+			ps[i].y = 1
+		end
+		for i = 0,100 do
+			w.sum = w.sum + ps[i].x + ps[i].y
+			w.pool:release(ps[i])
+		end
+	end
+	return nil
+end
+
+terra pool()
+	var p : PointPool
+	p:init(16)
+	var a = p:alloc()
+	p:release(a)
+	var b = p:alloc() --the released object is handed out again
+	var same = [int](a == b)
+	p:release(b)
+
+	var threads : C.pthread_t[4]
+	var workers : Worker[4]
+	for i = 0,4 do
+		workers[i].pool = &p
+		workers[i].sum = 0
+		C.pthread_create(&threads[i],nil,work,&workers[i])
+	end
+	var total = 0
+	for i = 0,4 do
+		C.pthread_join(threads[i],nil)
+		total = total + workers[i].sum
+	end
+	p:free()
+	return same, total
+end
+
+local test = require("test")
+test.eq(arena(),3*(4950 + 4) + 100*(0+1+2))
+test.eq(bump(),3)
+test.eq(typedarena(),3*45)
+test.meq({1,4*10*(4950+100)},pool())
+
+--types aligned beyond what malloc guarantees
+struct Aligned { x : double }
+Aligned.alignment = 64
+local AlignedPool = alloc.Pool(Aligned)
+terra alignedpool()
+	var p : AlignedPool
+	p:init(7)
+	var misaligned = 0
+	for i = 0,20 do
+		var a = p:alloc()
+		a.x = i
+		if [int64](a) % 64 ~= 0 then
+			misaligned = misaligned + 1
+		end
+	end
+	p:free()
+	return misaligned
+end
+test.eq(alignedpool(),0)
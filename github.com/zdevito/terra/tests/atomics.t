@@ -0,0 +1,52 @@
+C = terralib.includecstring [[
+#include <pthread.h>
+]]
+
+counter = global(int)
+maximum = global(int64)
+lock = global(int)
+shared = global(int)
+
+local N = 10000
+
+terra worker(args : &uint8) : &uint8
+	var id = @[&int](args)
+	for i = 0,N do
+		terralib.fetchadd(&counter,1)
+		--spin lock protecting a non-atomic update
+		while terralib.cmpxchg(&lock,0,1,"acquire") ~= 0 do end
+		shared = shared + 1
+		terralib.atomicstore(&lock,0,"release")
+	end
+	terralib.fetchmax(&maximum,id*100)
+	return nil
+end
+
+terra foo()
+	counter,maximum,lock,shared = 0,-1,0,0
+	var threads : C.pthread_t[4]
+	var args = arrayof(int,0,1,2,3)
+	for i = 0,4 do
+		C.pthread_create(&threads[i],nil,worker,&args[i])
+	end
+	for i = 0,4 do
+		C.pthread_join(threads[i],nil)
+	end
+	terralib.fence()
+	return terralib.atomicload(&counter,"acquire"), shared, maximum
+end
+
+terra singlethreaded()
+	var x : uint8 = 200
+	var old = terralib.exchange(&x,10)
+	terralib.fetchmin(&x,3)
+	terralib.fetchsub(&x,1)
+	terralib.fetchor(&x,8)
+	terralib.fetchxor(&x,1)
+	terralib.fetchand(&x,14)
+	return old, x
+end
+
+local test = require("test")
+test.meq({4*N,4*N,300},foo())
+test.meq({200,10},singlethreaded())
@@ -0,0 +1,214 @@
+--runs each benchmark and its C/C++ reference several times and reports the timings
+--usage (from this directory, or "make benchmark" from the top level):
+--    ../../terra harness.t [-n runs] [-o results.json] [name ...]
+--terra benchmarks are loaded into this process, so the time to define and compile their entry point
+--is measured separately from the time to run it. References are built with $CC/$CXX (clang by default)
+--into ./refbuild and timed as whole processes.
+--benchmarks whose reference needs Eigen are skipped unless EIGEN_INCLUDE points at the Eigen headers.
+--command benchmarks time a short-lived process, running it runsperrun times per sample and reporting the time per process.
+
+local benchmarks = {
+    { name = "nbody", terra = "../benchmark_nbody.t", entry = "main", reference = "../reference/benchmark_nbody.c", args = {"1000000"} },
+    { name = "fannkuchredux", terra = "../benchmark_fannkuchredux.t", entry = "main", reference = "../reference/benchmark_fannkuchredux.c", args = {"10"} },
+    --these print their own timings and rely on the fusion prototype, so they are timed as whole scripts
+    { name = "blackscholes", script = "bs.t", reference = "bs_eigen.cpp", needs = "EIGEN_INCLUDE" },
+    { name = "raysphere", script = "raysphere.t", reference = "raysphere_eigen.cpp", needs = "EIGEN_INCLUDE" },
+    --time to start the terra executable and run nothing, compared to starting plain luajit
+    { name = "startup", command = "../../terra -e ''", referencecommand = "../../build/LuaJIT-2.0.1/src/luajit -e ''", runsperrun = 20 },
+}
+
+local runs = 5
+local output = "results.json"
+local selected = {}
+local i = 1
+while i <= #arg do
+    if arg[i] == "-n" then
+        runs = assert(tonumber(arg[i+1]),"-n expects a number")
+        i = i + 1
+    elseif arg[i] == "-o" then
+        output = arg[i+1]
+        i = i + 1
+    else
+        selected[arg[i]] = true
+    end
+    i = i + 1
+end
+
+local now = terralib.currenttimeinseconds
+
+local function statistics(samples)
+    local sorted = {}
+    local sum = 0
+    for i,s in ipairs(samples) do
+        sorted[i] = s
+        sum = sum + s
+    end
+    table.sort(sorted)
+    local n = #sorted
+    local median = (n % 2 == 1 and sorted[(n+1)/2]) or (sorted[n/2] + sorted[n/2+1])/2
+    local mean = sum / n
+    local variance = 0
+    for i,s in ipairs(sorted) do
+        variance = variance + (s - mean)^2
+    end
+    variance = (n > 1 and variance / (n - 1)) or 0
+    return { median = median, mean = mean, variance = variance, min = sorted[1], max = sorted[n], samples = samples }
+end
+
+local function timeprocess(cmd,repeats)
+    repeats = repeats or 1
+    local samples = {}
+    for r = 1,runs do
+        local begin = now()
+        for k = 1,repeats do
+            if os.execute(cmd.." > /dev/null") ~= 0 then
+                error("command failed: "..cmd)
+            end
+        end
+        samples[r] = (now() - begin) / repeats
+    end
+    return samples
+end
+
+local function buildreference(b)
+    os.execute("mkdir -p refbuild")
+    local exe = "refbuild/"..b.name
+    local cmd
+    if b.reference:match("%.cpp$") then
+        cmd = (os.getenv("CXX") or "clang++").." -O3 -I"..(os.getenv("EIGEN_INCLUDE") or ".")
+    else
+        cmd = (os.getenv("CC") or "clang").." -O3"
+    end
+    cmd = cmd.." "..b.reference.." -o "..exe.." -lm"
+    if os.execute(cmd) ~= 0 then
+        error("failed to build reference: "..cmd)
+    end
+    return exe
+end
+
+--loads a benchmark file without the side effects it has when run as a test
+local function loadbenchmark(filename)
+    local chunk = assert(terralib.loadfile(filename))
+    local quiettest = { eq = function() end, meq = function() end, neq = function() end, time = function() return 0 end }
+    local env = setmetatable({
+        terralib = setmetatable({ saveobj = function() end },{ __index = terralib }),
+        require = function(name)
+            if name == "test" then
+                return quiettest
+            end
+            return require(name)
+        end,
+    },{ __index = _G })
+    setfenv(chunk,env)
+    chunk()
+    return env
+end
+
+local function runterra(b)
+    local begin = now()
+    local env = loadbenchmark(b.terra)
+    local fn = env[b.entry]
+    fn:compile()
+    local compile = now() - begin
+
+    local argv = terralib.new(rawstring[#b.args + 2])
+    local strings = {}
+    argv[0] = "benchmark"
+    for i,a in ipairs(b.args) do
+        strings[i] = terralib.new(int8[#a+1],a)
+        argv[i] = strings[i]
+    end
+    local samples = {}
+    for r = 1,runs do
+        local begin = now()
+        fn(#b.args + 1,argv)
+        samples[r] = now() - begin
+    end
+    return compile,samples
+end
+
+local results = {}
+for _,b in ipairs(benchmarks) do
+    if next(selected) == nil or selected[b.name] then
+        local result = { name = b.name }
+        if b.needs and not os.getenv(b.needs) then
+            print(("%s: skipped, set %s to run it"):format(b.name,b.needs))
+        else
+            if b.terra then
+                local compile,samples = runterra(b)
+                result.compile = compile
+                result.terra = statistics(samples)
+            elseif b.command then
+                result.terra = statistics(timeprocess(b.command,b.runsperrun))
+            else
+                result.terra = statistics(timeprocess("../../terra "..b.script))
+            end
+            if b.referencecommand then
+                result.reference = statistics(timeprocess(b.referencecommand,b.runsperrun))
+            else
+                local args = table.concat(b.args or {}," ")
+                result.reference = statistics(timeprocess(buildreference(b).." "..args))
+            end
+            table.insert(results,result)
+        end
+    end
+end
+
+print()
+print(("%-16s %10s %12s %12s %12s %12s %8s"):format("benchmark","compile","terra","variance","reference","variance","ratio"))
+for _,r in ipairs(results) do
+    print(("%-16s %10s %12.6f %12.3g %12.6f %12.3g %8.3f"):format(r.name,
+        (r.compile and ("%.4f"):format(r.compile)) or "-",
+        r.terra.median,r.terra.variance,r.reference.median,r.reference.variance,r.terra.median/r.reference.median))
+end
+
+--JSON strings only allow the escapes below, and every other control character as \u00XX
+local jsonescapes = { ['"'] = '\\"', ["\\"] = "\\\\", ["\b"] = "\\b", ["\f"] = "\\f", ["\n"] = "\\n", ["\r"] = "\\r", ["\t"] = "\\t" }
+local function jsonstring(s)
+    return '"'..tostring(s):gsub('[%c"\\]',function(c)
+        return jsonescapes[c] or ("\\u%04x"):format(c:byte())
+    end)..'"'
+end
+
+--machine-readable results, one object per benchmark, times in seconds
+local function tojson(v)
+    if type(v) == "table" then
+        local parts = {}
+        if #v > 0 then
+            for i,e in ipairs(v) do
+                parts[i] = tojson(e)
+            end
+            return "["..table.concat(parts,",").."]"
+        end
+        local keys = {}
+        for k in pairs(v) do
+            table.insert(keys,k)
+        end
+        table.sort(keys)
+        for i,k in ipairs(keys) do
+            parts[i] = jsonstring(k)..":"..tojson(v[k])
+        end
+        return "{"..table.concat(parts,",").."}"
+    elseif type(v) == "string" then
+        return jsonstring(v)
+    elseif type(v) == "number" and (v ~= v or v == math.huge or v == -math.huge) then
+        return "null" --JSON has no representation for nan and inf
+    elseif v == nil then
+        return "null"
+    else
+        return tostring(v)
+    end
+end
+
+local revision = io.popen("git rev-parse --short HEAD 2>/dev/null"):read("*l")
+local file = assert(io.open(output,"w"))
+file:write(tojson {
+    revision = revision or "unknown",
+    llvmversion = terralib.llvmversion,
+    date = os.date("!%Y-%m-%dT%H:%M:%SZ"),
+    runs = runs,
+    benchmarks = results,
+})
+file:write("\n")
+file:close()
+print("results written to "..output)
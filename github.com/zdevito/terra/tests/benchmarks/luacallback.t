@@ -0,0 +1,32 @@
+-- per-call overhead of calling a lua function from terra
+-- native callbacks (terralib.usenativecallbacks) vs. ffi callbacks
+
+local N = 1000000
+local count = 0
+local function inc(a,b)
+	count = count + a
+end
+
+local function makeloop()
+	return terra(n : int)
+		for i = 0,n do
+			inc(i,1.5)
+		end
+	end
+end
+
+local function bench(name)
+	local loop = makeloop()
+	loop:compile()
+	count = 0
+	local begin = terralib.currenttimeinseconds()
+	loop(N)
+	local elapsed = terralib.currenttimeinseconds() - begin
+	print(string.format("%s: %.1f ns/call",name,elapsed / N * 1e9))
+	assert(count == (N-1)*N/2)
+end
+
+terralib.usenativecallbacks = false
+bench("ffi callback")
+terralib.usenativecallbacks = true
+bench("native callback")
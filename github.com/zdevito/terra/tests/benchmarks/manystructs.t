@@ -0,0 +1,70 @@
+--time to define, typecheck, and compile code that uses thousands of generated struct types
+--each struct nests the previous ones by value, through pointers, and in arrays, so the same
+--derived types are looked up over and over and every layout depends on several others
+local N = 4000
+
+local function bench(name,fn)
+	local begin = terralib.currenttimeinseconds()
+	local r = fn()
+	local elapsed = terralib.currenttimeinseconds() - begin
+	print(string.format("%s: %.3f s",name,elapsed))
+	return r
+end
+
+local structs = bench("define structs",function()
+	local structs = {}
+	for i = 1,N do
+		local S = terralib.types.newstruct("S"..i)
+		S.entries:insert({ field = "value", type = int })
+		if i > 1 then
+			local prev = structs[i-1]
+			S.entries:insert({ field = "prev", type = prev })
+			S.entries:insert({ field = "others", type = (&structs[math.max(1,i-8)])[4] })
+			S.entries:insert({ field = "callback", type = { &prev, &S } -> int })
+		end
+		structs[i] = S
+	end
+	return structs
+end)
+
+bench("layout",function()
+	for i,S in ipairs(structs) do
+		S:complete()
+	end
+end)
+
+bench("derived types",function()
+	for k = 1,10 do
+		for i,S in ipairs(structs) do
+			local p = &S
+			local a = S[16]
+			local f = { &S, int } -> { &S }
+			assert(p == &S and a == S[16] and f == { &S, int } -> { &S })
+		end
+	end
+end)
+
+local fns = bench("typecheck",function()
+	local fns = {}
+	for i = 2,N do
+		local S = structs[i]
+		local terra get(s : &S, n : int) : int
+			var sum = s.value + s.prev.value
+			for j = 0,4 do
+				if s.others[j] ~= nil then
+					sum = sum + s.others[j].value
+				end
+			end
+			return sum + n
+		end
+		get:gettype()
+		fns[#fns + 1] = get
+	end
+	return fns
+end)
+
+bench("compile",function()
+	for i,fn in ipairs(fns) do
+		fn:compile()
+	end
+end)
@@ -0,0 +1,70 @@
+--constant expressions are lowered to LLVM constants, so tables of function pointers need no initialization code
+terra square(x : double) : double return x*x end
+terra cube(x : double) : double return x*x*x end
+
+struct Entry {
+	name : rawstring
+	fn : {double} -> double
+	weight : int
+}
+
+local N = 3
+local entries = constant(`arrayof(Entry, Entry { "square", square, 2 }, Entry { "cube", cube, 3 }, Entry { "half", nil, N*4 - 1 }))
+
+terra apply(i : int, x : double) : double
+	var e = entries[i]
+	if e.fn == nil then
+		return e.weight
+	end
+	return e.fn(x) * e.weight
+end
+
+local test = require("test")
+test.eq(apply(0,3),18)
+test.eq(apply(1,2),24)
+test.eq(apply(2,2),11)
+
+--scalar constant expressions and implicit casts to an explicit type
+local limit = constant(int64,`(1 << 20) + sizeof(Entry))
+local scale = constant(`float(N) / 2)
+terra getlimit() return limit end
+terra getscale() return scale end
+test.eq(getlimit(),1048576 + terralib.sizeof(Entry))
+test.eq(getscale(),1.5)
+
+--globals initialized with the addresses of other globals and functions
+struct Config {
+	counter : &int
+	op : {double} -> double
+	bias : double
+}
+local counter = global(int,0)
+local config = global(Config,`Config { &counter, cube, 0.5 })
+
+terra useconfig(x : double) : double
+	@config.counter = @config.counter + 1
+	return config.op(x) + config.bias
+end
+test.eq(useconfig(2),8.5)
+test.eq(useconfig(1),1.5)
+test.eq(counter:get(),2)
+
+--reading a global variable or calling a function is not constant
+function failit(match,fn)
+	local success,msg = pcall(fn)
+	if success then
+		error("failed to fail.",2)
+	elseif not string.match(msg,match) then
+		error("failed wrong: "..msg,2)
+	end
+end
+failit("cannot be used in a constant expression",function()
+	local c = constant(`square(2))
+	local terra usec() return c end
+	usec()
+end)
+failit("cannot be used in a constant expression",function()
+	local c = constant(`counter + 1)
+	local terra usec() return c end
+	usec()
+end)
@@ -0,0 +1,32 @@
+--large lookup tables built from lua arrays are embedded as a single block of constant data
+local N = 262144
+local values = {}
+for i = 1,N do
+	values[i] = (i-1) % 7
+end
+
+local floats = terralib.constant(float[N],values)
+local ints = terralib.constant(values) --inferred as int[N]
+local doubles = terralib.constant({0.5,1.5,2.5})
+
+terra sum() : double
+	var s = 0.0
+	for i = 0,N do
+		s = s + floats[i] + ints[i]
+	end
+	return s + doubles[0] + doubles[1] + doubles[2]
+end
+
+local test = require("test")
+local expected = 0
+for i = 1,N do
+	expected = expected + 2*values[i]
+end
+test.eq(terralib.typeof(ints.object) == int[N],true)
+test.eq(sum(),expected + 4.5)
+
+--a table used from several functions through an escape is only embedded once
+local cdata = terralib.new(int16[4],{1,2,3,4})
+terra first() return cdata[0] end
+terra last() return cdata[3] end
+test.eq(first() + last(),5)
@@ -0,0 +1,44 @@
+terralib.debuginfo = true
+
+struct Point {
+	x : double;
+	y : double;
+	next : &Point;
+}
+
+terra length(p : &Point, n : int)
+	var total = 0.0
+	var deltas : double[2]
+	while p.next ~= nil and n > 0 do
+		deltas[0] = p.next.x - p.x
+		deltas[1] = p.next.y - p.y
+		total = total + deltas[0]*deltas[0] + deltas[1]*deltas[1]
+		p = p.next
+		n = n - 1
+	end
+	return total
+end
+
+terra run()
+	var ps : Point[3]
+	for i = 0,3 do
+		ps[i].x = i
+		ps[i].y = 2*i
+		ps[i].next = &ps[i+1]
+	end
+	ps[2].next = nil
+	return length(&ps[0],10)
+end
+
+local test = require("test")
+test.eq(run(),10)
+
+terralib.saveobj("debuginfo.o",{ run = run })
+local f = assert(io.open("debuginfo.o","rb"))
+local obj = f:read("*a")
+f:close()
+--section names are .debug_info/.debug_line in ELF and __debug_info/__debug_line in Mach-O
+test.eq(obj:find("debug_info",1,true) ~= nil,true)
+test.eq(obj:find("debug_line",1,true) ~= nil,true)
+os.remove("debuginfo.o")
+terralib.debuginfo = false
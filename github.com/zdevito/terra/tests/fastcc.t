@@ -0,0 +1,81 @@
+--calls between terra functions use an internal convention, calls from lua, C, and through pointers use the C ABI
+struct Vec3 { x : double, y : double, z : double }
+struct Big { a : double[8] }
+
+terra add(a : Vec3, b : Vec3) : Vec3
+	return Vec3 { a.x + b.x, a.y + b.y, a.z + b.z }
+end
+
+terra scale(a : Vec3, s : double) : Vec3
+	return Vec3 { a.x*s, a.y*s, a.z*s }
+end
+
+terra minmax(a : int, b : int) : {int,int}
+	if a < b then
+		return a,b
+	else
+		return b,a
+	end
+end
+
+terra fill(v : double) : Big
+	var b : Big
+	for i = 0,8 do
+		b.a[i] = v + i
+	end
+	return b
+end
+
+terra total(b : Big, extra : Vec3) : double
+	var s = extra.x + extra.y + extra.z
+	for i = 0,8 do
+		s = s + b.a[i]
+	end
+	return s
+end
+
+terra chain() : double
+	var v = Vec3 { 1, 2, 3 }
+	for i = 0,4 do
+		v = scale(add(v,v),0.5)
+	end
+	var lo,hi = minmax(7,3)
+	return total(fill(1),v) + lo*100 + hi*1000
+end
+
+local test = require("test")
+--1+2+3 + (1+...+8) + 300 + 7000
+test.eq(chain(),6 + 36 + 300 + 7000)
+
+--the same functions called from lua and through a function pointer go through the C ABI
+test.eq(total(fill(2),{1,1,1}),3 + 8*2 + 28)
+local lo,hi = minmax(5,2)
+test.eq(lo,2)
+test.eq(hi,5)
+
+terra callthrough(fn : {Vec3,Vec3} -> Vec3) : double
+	var r = fn(Vec3 {1,2,3}, Vec3 {4,5,6})
+	return r.x + r.y + r.z
+end
+terra usepointer() : double
+	return callthrough(add)
+end
+test.eq(usepointer(),21)
+
+--mutual recursion through the internal convention
+terra iseven(a : uint) : int
+	if a == 0 then
+		return 1
+	else
+		return isodd(a - 1)
+	end
+end and
+terra isodd(a : uint) : int
+	if a == 0 then
+		return 0
+	else
+		return iseven(a - 1)
+	end
+end
+test.eq(iseven(10),1)
+test.eq(isodd(7),1)
@@ -0,0 +1,49 @@
+local fusion = terralib.require("std.fusion")
+local C = terralib.includec("math.h")
+
+local test = require("test")
+
+local N = 37 --not a multiple of the vector width, so the remainder loop runs too
+local a,b = fusion.array(double,N),fusion.array(double,N)
+for i = 0,N-1 do
+	a.data[i] = i
+	b.data[i] = N - i
+end
+
+local c,d = fusion.eval(a*2 + b, -(a - b)/2)
+for i = 0,N-1 do
+	test.eq(c.data[i],2*i + (N - i))
+	test.eq(d.data[i],-(i - (N - i))/2)
+end
+
+--the elementwise part is computed inside the reduction loop
+test.eq(fusion.sum(a + b),N*N)
+test.eq(fusion.maximum(a*b),18*19)
+test.eq(fusion.minimum(fusion.min(a,b) - 1),-1)
+
+local sqrt = fusion.map(C.sqrt)
+local s = fusion.eval(sqrt(a*a))
+for i = 0,N-1 do
+	test.eq(s.data[i],i)
+end
+
+--same shape with different arrays and constants reuses the kernel
+local compiled,reused = fusion.stats()
+local e = fusion.eval(b*3 + a)
+local f = fusion.eval(c*5 + d)
+local compiled2,reused2 = fusion.stats()
+test.eq(compiled2,compiled + 1)
+test.eq(reused2,reused + 1)
+test.eq(f.data[3],c.data[3]*5 + d.data[3])
+
+--in place update
+fusion.assign(a,a + 1)
+test.eq(a.data[N-1],N)
+
+local xs = fusion.array(int,100)
+for i = 0,99 do
+	xs.data[i] = i - 50
+end
+test.eq(fusion.sum(xs*xs),42925 + 40425)
+test.eq(fusion.minimum(xs),-50)
+test.eq(fusion.maximum(fusion.max(xs,0)),49)
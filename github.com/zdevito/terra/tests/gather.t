@@ -0,0 +1,56 @@
+local C = terralib.includec("stdlib.h")
+
+terra sum4(v : vector(float,4))
+	return v[0] + v[1] + v[2] + v[3]
+end
+
+terra gathersum(a : &float)
+	var idx = vector(0,3,5,7)
+	return sum4(terralib.gather(a + idx))
+end
+
+terra maskedgather(a : &float)
+	var ptrs = a + vector(1,2,1000000,4)
+	var v = terralib.gather(ptrs, vector(true,true,false,true), vector(100.f,100.f,100.f,100.f))
+	return v[2] + v[3]
+end
+
+terra scatter(a : &float)
+	var ptrs = vector(a,a,a,a) + vector(8,9,10,11)
+	terralib.scatter(ptrs, vector(1.f,2.f,3.f,4.f), vector(true,false,true,false))
+	return a[8] + a[9] + a[10] + a[11]
+end
+
+terra tail(a : &float, n : int)
+	var p = [&vector(float,4)](a)
+	var mask = vector(0,1,2,3) < n
+	var v = terralib.maskedload(p, mask, vector(0.f,0.f,0.f,0.f))
+	terralib.maskedstore(p, v + 1.f, mask)
+	return sum4(v)
+end
+
+terra run()
+	var a = [&float](C.malloc(sizeof(float)*16))
+	for i = 0,16 do
+		a[i] = i
+	end
+	var r0 = gathersum(a)
+	var r1 = maskedgather(a)
+	var r2 = scatter(a)
+	var r3 = tail(a+12,3)
+	var r4 = a[14] + a[15]
+	C.free(a)
+	return r0,r1,r2,r3,r4
+end
+
+local test = require("test")
+test.meq({15,104,24,39,30},run())
+
+--explicit casts between scalars are unaffected by the rules for vectors of pointers
+terra scalarcasts(i : int)
+	var a = int(3.5)
+	var b = [double](i)
+	var c = uint8(i + 250)
+	return a + b + c
+end
+test.eq(scalarcasts(10),3 + 10 + 4)
@@ -0,0 +1,47 @@
+--code for functions that are garbage collected is reused by the functions generated after them
+local function makekernel(n)
+	local x,k = symbol(int),symbol(int)
+	local body = terralib.newlist()
+	for i = 1,200 do
+		body:insert(quote [x] = [x] * [k] + (i + n) end)
+	end
+	return terra([x] : int, [k] : int) : int
+		[body]
+		return [x]
+	end
+end
+
+local test = require("test")
+
+local kernel = makekernel(0)
+test.eq(kernel(1,1),1 + 200*201/2)
+local before = terralib.jitmemory()
+test.eq(before.live > 0,true)
+test.eq(before.functions > 0,true)
+test.eq(before.live + before.free <= before.reserved,true)
+
+--regenerating many kernels only needs as much memory as the few that are alive at once
+for i = 1,2000 do
+	kernel = makekernel(i)
+	kernel(1,1)
+	collectgarbage()
+end
+local after = terralib.jitmemory()
+test.eq(after.functions < before.functions + 2000,true)
+test.eq(after.reserved <= before.reserved + 4*1024*1024,true)
+
+function failit(match,fn)
+	local success,msg = pcall(fn)
+	if success then
+		error("failed to fail.",2)
+	elseif not string.match(msg,match) then
+		error("failed wrong: "..msg,2)
+	end
+end
+terralib.setjitmemorylimit(1)
+test.eq(terralib.jitmemory().limit,1)
+failit("JIT code memory limit reached",function()
+	makekernel(-1):compile()
+end)
+terralib.setjitmemorylimit(nil)
+test.eq(makekernel(-2)(0,0),-2 + 200)
@@ -0,0 +1,75 @@
+local C = terralib.includec("stdlib.h")
+
+terra sum(a : &float, N : int)
+	var s = 0.f
+	terralib.unroll(4)
+	terralib.vectorize(8)
+	terralib.interleave(2)
+	for i = 0,N do
+		terralib.prefetch(a + i + 64)
+		s = s + a[i]
+	end
+	return s
+end
+
+terra copy(a : &float, b : &float, N : int)
+	var i = 0
+	terralib.unroll(2)
+	while i < N do
+		terralib.prefetch(b + i + 64, 1, 0)
+		b[i] = a[i]
+		i = i + 1
+	end
+end
+
+terra run()
+	var N = 1000
+	var a = [&float](C.malloc(sizeof(float)*N))
+	var b = [&float](C.malloc(sizeof(float)*N))
+	for i = 0,N do
+		a[i] = 1
+	end
+	copy(a,b,N)
+	var r = sum(b,N)
+	C.free(a)
+	C.free(b)
+	return r
+end
+
+local test = require("test")
+test.eq(run(),1000)
+
+--stats.annotatedloops counts the loops that were given llvm.loop metadata
+local function annotated(fn)
+	return fn:getdefinitions()[1].stats.annotatedloops or 0
+end
+test.eq(annotated(sum),1)
+test.eq(annotated(copy),1)
+test.eq(annotated(run),0)
+
+--the hint applies to the assignment that follows it, not to the later loop
+terra discarded(N : int)
+	var s = 0
+	terralib.unroll(4)
+	s = 1
+	while s < N do
+		s = s * 2
+	end
+	return s
+end
+test.eq(discarded(100),128)
+test.eq(annotated(discarded),0)
+
+--hints apply to the loop that follows them but not to loops nested inside it
+terra nested(N : int)
+	var s = 0
+	terralib.unroll(2)
+	for i = 0,N do
+		for j = 0,N do
+			s = s + j
+		end
+	end
+	return s
+end
+test.eq(nested(4),24)
+test.eq(annotated(nested),1)
@@ -0,0 +1,37 @@
+terralib.useluastubs = true
+
+terra add(a : int, b : double)
+	return a + b
+end
+terra swap(a : int, b : float)
+	return b,a
+end
+terra isnull(a : &int)
+	return a == nil
+end
+terra neg(a : bool)
+	return not a
+end
+terra big() : int64
+	return 1
+end
+
+local test = require("test")
+
+test.eq(add(1,2.5),3.5)
+test.eq(add.fastcall,add:getdefinitions()[1]:getluastub())
+
+local a,b = swap(1,2.5)
+test.eq(a,2.5)
+test.eq(b,1)
+
+test.eq(isnull(nil),true)
+--cdata arguments go through the ffi fallback
+test.eq(isnull(terralib.new(int[1])),false)
+
+test.eq(neg(true),false)
+test.eq(neg(false),true)
+
+--int64 results are cdata in the ffi, so no stub is generated
+test.eq(big:getdefinitions()[1]:getluastub(),nil)
+test.eq(big(),1LL)
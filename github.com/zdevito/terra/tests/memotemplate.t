@@ -0,0 +1,62 @@
+local generated = 0
+local Sum = terralib.newtemplate(function(T,N)
+	generated = generated + 1
+	return terra(a : &T) : T
+		var s : T = 0
+		for i = 0,N do
+			s = s + a[i]
+		end
+		return s
+	end
+end,"Sum")
+
+local List = terralib.newtemplate(function(T)
+	local struct List {
+		value : T;
+		next : &List;
+	}
+	return List
+end)
+
+local test = require("test")
+
+local a = Sum(int,4)
+local b = Sum(int,4)
+local c = Sum(int,3)
+local d = Sum(double,4)
+assert(a == b and a ~= c and a ~= d)
+test.eq(generated,3)
+
+local arr = terralib.new(int[4],{1,2,3,4})
+test.eq(a(arr),10)
+test.eq(c(arr),6)
+--the reused function keeps its compiled definition
+test.eq(b(arr),10)
+test.eq(a:getdefinitions()[1],b:getdefinitions()[1])
+
+test.meq({1,3},Sum:stats())
+assert(List(int) == List(int))
+assert(List(int) ~= List(float))
+assert(terralib.istemplate(List))
+
+--arguments are keyed by value for numbers, so an integer-valued float matches
+assert(Sum(int,4.0) == a)
+test.meq({2,3},Sum:stats())
+
+--errors are not cached
+local fails = true
+local Checked = terralib.newtemplate(function(n)
+	if fails then
+		error("not yet")
+	end
+	return n
+end)
+assert(not pcall(Checked,1))
+fails = false
+test.eq(Checked(1),1)
+
+local Recursive
+Recursive = terralib.newtemplate(function(n)
+	return Recursive(n)
+end)
+assert(not pcall(Recursive,1))
@@ -0,0 +1,67 @@
+--independent lua states running terra on separate threads, each compiles with its own LLVM context
+C = terralib.includecstring [[
+    #include "lua.h"
+    #include "lauxlib.h"
+    #include "lualib.h"
+    #include <pthread.h>
+    //macros are not imported, so the constants we need are returned from functions
+    int globalsindex() { return LUA_GLOBALSINDEX; }
+    int multret() { return LUA_MULTRET; }
+    int terra_init(lua_State * L);
+    int terra_loadstring(lua_State *L, const char *s);
+]]
+
+local program = [[
+    terra sum(n : int)
+        var s = 0
+        for i = 0,n do
+            s = s + i
+        end
+        return s
+    end
+    result = sum(100)
+]]
+
+struct Worker {
+    result : double
+    err : int
+}
+
+terra work(arg : &opaque) : &opaque
+    var w = [&Worker](arg)
+    var L = C.luaL_newstate()
+    C.luaL_openlibs(L)
+    w.err = C.terra_init(L)
+    if w.err == 0 then
+        w.err = C.terra_loadstring(L,program)
+    end
+    if w.err == 0 then
+        w.err = C.lua_pcall(L,0,C.multret(),0)
+    end
+    if w.err == 0 then
+        C.lua_getfield(L,C.globalsindex(),"result")
+        w.result = C.lua_tonumber(L,-1)
+    end
+    C.lua_close(L)
+    return nil
+end
+
+terra run(n : int)
+    var threads : C.pthread_t[4]
+    var workers : Worker[4]
+    for i = 0,n do
+        workers[i].result = 0
+        C.pthread_create(&threads[i],nil,work,&workers[i])
+    end
+    var total = 0.0
+    for i = 0,n do
+        C.pthread_join(threads[i],nil)
+        if workers[i].err == 0 then
+            total = total + workers[i].result
+        end
+    end
+    return total
+end
+
+local test = require("test")
+test.eq(run(4),4*4950)
@@ -0,0 +1,60 @@
+terralib.usenativecallbacks = true
+local test = require("test")
+
+local seen = {}
+local function record(a,b,c)
+	seen.a,seen.b,seen.c = a,b,c
+end
+
+struct S { x : int }
+
+terra callrecord(s : &S)
+	record(3,true,4.5)
+	record(-1,false,s)
+end
+
+local s = terralib.new(S[1])
+s[0].x = 7
+callrecord(s)
+test.eq(seen.a,-1)
+test.eq(seen.b,false)
+--pointers are handed to lua as cdata, just like ffi callbacks
+test.eq(seen.c.x,7)
+
+--one stub per (function, type)
+terra callagain(a : int)
+	record(a,true,1.0)
+end
+callagain(2)
+test.eq(seen.a,2)
+local cache = terralib.__nativecallbacks[record]
+local n = 0
+for k,v in pairs(cache) do
+	n = n + 1
+end
+test.eq(n,2)
+
+--int64 arguments still go through an ffi callback
+local big
+terra callbig(a : int64)
+	[function(v) big = v end](a)
+end
+callbig(5)
+test.eq(big,5LL)
+
+--stubs are deleted along with the last function that calls them, even when both are collected together
+local function makecaller(i)
+	local terra caller(a : int)
+		[function(v) seen.a = v + i end](a)
+	end
+	return caller
+end
+makecaller(0)(1)
+collectgarbage()
+local before = terralib.jitmemory().functions
+for i = 1,200 do
+	makecaller(i)(1)
+	collectgarbage()
+end
+test.eq(seen.a,201)
+test.eq(terralib.jitmemory().functions <= before + 4,true)
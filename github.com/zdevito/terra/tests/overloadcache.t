@@ -0,0 +1,82 @@
+--a call to an overloaded function is resolved once for each combination of argument types,
+--unless one of the types involved has a __cast metamethod, which is invoked every time
+local test = require("test")
+function failit(match,fn)
+    local success,msg = pcall(fn)
+    if success then
+        error("failed to fail.",2)
+    elseif not string.match(msg,match) then
+        error("failed wrong: "..msg,2)
+    end
+end
+
+local casts = 0
+struct A { a : int }
+struct B { b : double }
+
+function A.metamethods.__cast(from,to,exp)
+    casts = casts + 1
+    if from == int and to == A then
+        return `A { exp }
+    end
+    error("invalid")
+end
+function B.metamethods.__cast(from,to,exp)
+    casts = casts + 1
+    if from == double and to == B then
+        return `B { exp }
+    end
+    error("invalid")
+end
+
+terra get(a : A) return a.a end
+terra get(b : B) return b.b end
+
+terra first()
+    return get(1) + get(2.5)
+end
+first:compile()
+local firstcasts = casts
+
+terra second()
+    return get(3) + get(4.5) + get(5)
+end
+second:compile()
+
+test.eq(firstcasts,4)
+test.eq(casts - firstcasts,6)
+test.eq(first(),3.5)
+test.eq(second(),12.5)
+
+--calls that matched no option still report an error the second time they are seen
+for i = 1,2 do
+    failit("Errors reported during",function()
+        local terra bad()
+            return get("what")
+        end
+        bad:compile()
+    end)
+end
+
+--a resolution cached before a __cast metamethod is added is not reused afterwards
+struct W { w : int }
+terra wrap(w : W) return w.w end
+terra wrap(d : double) return d + 0.5 end
+
+terra beforecast()
+    return wrap(1)
+end
+test.eq(beforecast(),1.5)
+
+W.metamethods.__cast = function(from,to,exp)
+    if from == int and to == W then
+        return `W { exp }
+    end
+    error("invalid")
+end
+failit("Errors reported during",function()
+    local terra aftercast()
+        return wrap(1) --now ambiguous
+    end
+    aftercast:compile()
+end)
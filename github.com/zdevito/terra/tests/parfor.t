@@ -0,0 +1,44 @@
+local parallel = terralib.require("std.parallel")
+local C = terralib.includec("stdlib.h")
+
+struct Args {
+	input : &double;
+	output : &double;
+	total : int64;
+}
+
+terra blur(i : int64, a : &Args)
+	a.output[i] = (a.input[i-1] + a.input[i] + a.input[i+1])/3
+	terralib.fetchadd(&a.total,1)
+end
+
+terra run(N : int64, grain : int64)
+	var args : Args
+	args.input = [&double](C.malloc(sizeof(double)*N))
+	args.output = [&double](C.malloc(sizeof(double)*N))
+	args.total = 0
+	for i = 0,N do
+		args.input[i] = i
+		args.output[i] = 0
+	end
+	if grain == 0 then
+		parallel.parfor(1,N-1,blur,&args)
+	else
+		parallel.parfor(1,N-1,blur,&args,grain)
+	end
+	var sum = 0.0
+	for i = 0,N do
+		sum = sum + args.output[i]
+	end
+	C.free(args.input)
+	C.free(args.output)
+	return sum, args.total
+end
+
+local N = 100000
+local expected = (N-1)*(N-2)/2 --sum of 1..N-2
+local test = require("test")
+assert(parallel.numthreads() >= 1)
+test.meq({expected,N-2},run(N,0))
+test.meq({expected,N-2},run(N,7))
+test.meq({0,0},run(1,0))
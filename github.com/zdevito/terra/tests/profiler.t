@@ -0,0 +1,32 @@
+terra spin(n : int) : double
+	var x = 0.0
+	for i = 0,n do
+		x = x*0.999999 + 1.0
+	end
+	return x
+end
+
+local test = require("test")
+
+terralib.profiler.start(1000)
+local begin = terralib.currenttimeinseconds()
+while terralib.currenttimeinseconds() - begin < 0.5 do
+	spin(1000000)
+end
+local profile = terralib.profiler.stop()
+terralib.profiler.print(profile,5)
+
+test.eq(profile.samples > 0,true)
+local found = false
+for i,f in ipairs(profile.functions) do
+	if f.name:match("^spin %(") then
+		found = f.self > 0 and f.total >= f.self
+	end
+end
+test.eq(found,true)
+
+--stopping twice is harmless, and the profiler can be restarted
+terralib.profiler.stop()
+terralib.profiler.start()
+local empty = terralib.profiler.stop()
+test.eq(empty.dropped,0)
@@ -0,0 +1,30 @@
+local reverse = {3,2,1,0}
+
+terra rev(v : vector(int,4))
+	return terralib.swizzle(v,[reverse])
+end
+
+terra interleave(a : vector(int,4), b : vector(int,4))
+	return terralib.shuffle(a,b,0,4,1,5)
+end
+
+--horizontal add of adjacent pairs, without the avx intrinsic
+terra hadd(a : vector(float,4), b : vector(float,4))
+	return terralib.shuffle(a,b,0,2,4,6) + terralib.shuffle(a,b,1,3,5,7)
+end
+
+terra splat(x : float)
+	var v : vector(float,8) = x
+	return v[0] + v[7]
+end
+
+terra run()
+	var r = rev(vector(1,2,3,4))
+	var i = interleave(vector(1,2,3,4),vector(5,6,7,8))
+	var h = hadd(vector(1.f,2.f,3.f,4.f),vector(5.f,6.f,7.f,8.f))
+	var n = terralib.swizzle(r,0,0)
+	return r[0]*1000 + r[3], i[0]*1000 + i[1]*100 + i[2]*10 + i[3], h[0] + h[1] + h[3], n[1], splat(2.5)
+end
+
+local test = require("test")
+test.meq({4001,1526,25,4,5},run())
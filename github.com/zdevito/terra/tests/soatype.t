@@ -0,0 +1,34 @@
+local soa = terralib.require("std.soa")
+
+struct Particle {
+	x : float;
+	y : float;
+	mass : double;
+}
+
+local Particles = soa.SoA(Particle)
+assert(soa.SoA(Particle) == Particles)
+
+terra run(N : int)
+	var ps : Particles
+	ps:init(N)
+	for i = 0,N do
+		var p : Particle
+		p.x, p.y, p.mass = i, 2*i, 1
+		ps:set(i,p)
+	end
+	--field arrays are contiguous
+	for i = 0,N do
+		ps.x[i] = ps.x[i] + ps.mass[i]
+	end
+	--element proxies
+	var p = ps:at(3)
+	p.y = p.y + p.x
+	var e = p:load()
+	var r = ps:get(4).x + e.y + ps:size()
+	ps:free()
+	return r
+end
+
+local test = require("test")
+test.eq(run(10),5 + (6 + 4) + 10)
@@ -0,0 +1,122 @@
+terralib.usetailcalls = true
+--deep mutual recursion only works if each tailcall reuses the frame of its caller
+terra iseven(a : uint) : bool
+	if a == 0 then
+		return true
+	end
+	return tailcall isodd(a - 1)
+end and
+terra isodd(a : uint) : bool
+	if a == 0 then
+		return false
+	end
+	return tailcall iseven(a - 1)
+end
+
+struct Vec3 { x : double, y : double, z : double }
+struct Big { a : double[8] }
+
+--results that are returned in registers, through the caller's buffer, or as several values
+terra sumto(n : int, acc : Vec3) : Vec3
+	if n == 0 then
+		return acc
+	end
+	return tailcall sumto(n - 1, Vec3 { acc.x + 1, acc.y + 2, acc.z + n })
+end
+
+terra fill(n : int, v : double) : Big
+	if n == 0 then
+		var b : Big
+		for i = 0,8 do
+			b.a[i] = v
+		end
+		return b
+	end
+	return tailcall fill(n - 1, v + 1)
+end
+
+terra fibpair(n : int, a : int64, b : int64) : {int64,int64}
+	if n == 0 then
+		return a,b
+	end
+	return tailcall fibpair(n - 1, b, a + b)
+end
+
+--tailcall is still a valid identifier
+terra identifiers()
+	var tailcall = 3
+	return tailcall
+end
+
+terra run()
+	var v = sumto(1000000, Vec3 { 0, 0, 0 })
+	var b = fill(1000000, 0)
+	var a,b2 = fibpair(50, 0, 1)
+	return v.x + v.y + b.a[7] + a
+end
+
+local test = require("test")
+test.eq(iseven(10000000),true)
+test.eq(isodd(10000001),true)
+test.eq(run(),1000000 + 2000000 + 1000000 + 12586269025)
+test.eq(identifiers(),3)
+
+function failit(match,fn)
+	local success,msg = pcall(fn)
+	if success then
+		error("failed to fail.",2)
+	elseif not string.match(msg,match) then
+		error("failed wrong: "..msg,2)
+	end
+end
+
+local C = terralib.includecstring [[ int abs(int); ]]
+failit("Errors reported during",function()
+	local terra bad(a : int) : int
+		return tailcall C.abs(a)
+	end
+	bad:compile()
+end)
+failit("Errors reported during",function()
+	local terra bad(a : int) : int
+		return tailcall iseven(a)
+	end
+	bad:compile()
+end)
+failit("Errors reported during",function()
+	local terra bad(a : uint) : {bool,int}
+		return tailcall iseven(a), 1
+	end
+	bad:compile()
+end)
+failit("pass a pointer instead",function()
+	local terra takesbig(b : Big) : double
+		return b.a[0]
+	end
+	local terra bad() : double
+		var b : Big
+		return tailcall takesbig(b)
+	end
+	bad:compile()
+end)
+failit("Errors reported during",function()
+	local terra takesptr(p : &int) : int
+		return @p
+	end
+	local terra bad(a : int) : int
+		var x = a
+		return tailcall takesptr(&x)
+	end
+	bad:compile()
+end)
+failit("Errors reported during",function()
+	local terra takesptr(p : &int) : int
+		return @p
+	end
+	local terra bad(a : int) : int
+		var xs : int[4]
+		xs[0] = a
+		return tailcall takesptr(xs)
+	end
+	bad:compile()
+end)